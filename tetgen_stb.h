@@ -23,8 +23,34 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
-#include <deque>
 #include <ctime>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cfloat>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <memory>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #define epsilon 1e-8
 #define inf 1e20
@@ -92,6 +118,44 @@ bool SameSide(const float4 &v1, const float4 &v2, const float4 &v3, const float4
 	return signf(dotV4) == signf(dotP);
 }
 
+// largest absolute coordinate of v (x, y, z)
+float MaxAbs(const float4 &v)
+{
+	return std::max(std::max(fabsf(v.x), fabsf(v.y)), fabsf(v.z));
+}
+
+/* 3-vector of float or double for the exit tests in selectable precision (see traverse_ray with tet_vec3 rays) */
+template <typename T>
+struct tet_vec3
+{
+	T x, y, z;
+};
+
+template <typename T> tet_vec3<T> make_vec3(T x, T y, T z) { tet_vec3<T> v = { x, y, z }; return v; }
+template <typename T> tet_vec3<T> operator-(const tet_vec3<T> &a, const tet_vec3<T> &b) { return make_vec3(a.x - b.x, a.y - b.y, a.z - b.z); }
+template <typename T> T Dot(const tet_vec3<T> &a, const tet_vec3<T> &b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+template <typename T> tet_vec3<T> Cross(const tet_vec3<T> &a, const tet_vec3<T> &b) { return make_vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+template <typename T> T MaxAbs(const tet_vec3<T> &v) { return std::max(std::max(std::abs(v.x), std::abs(v.y)), std::abs(v.z)); }
+template <typename T> int SignOf(T f) { return (f > 0) - (f < 0); }
+
+// spreads the lower 10 bits of v to every third bit
+uint32_t MortonSpread(uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+/* 30 bit Morton code of p inside the box lo..lo + 1 / scale, 10 bits per axis */
+uint32_t MortonCode(const float4 &p, const float4 &lo, const float4 &scale)
+{
+	auto cell = [](float f) { return (uint32_t)std::min(std::max(f * 1024.0f, 0.0f), 1023.0f); };
+	return MortonSpread(cell((p.x - lo.x) * scale.x)) | (MortonSpread(cell((p.y - lo.y) * scale.y)) << 1) | (MortonSpread(cell((p.z - lo.z) * scale.z)) << 2);
+}
+
 struct rayhit
 {
 	float4 pos;
@@ -101,6 +165,7 @@ struct rayhit
 	bool wall = false;
 	bool constrained = false;
 	bool dark = false; // if hitpoint is too far away
+	bool lost = false; // no exit face found, the ray does not pass through the tetrahedron
 };
 
 struct BBox
@@ -111,8 +176,8 @@ struct BBox
 struct node
 {
 	uint32_t index;
-	float x, y, z;
-	float4 f_node(){ return make_float4(x, y, z, 0); }
+	double x, y, z; // as read, mesh2 rounds them to float (see init_double_nodes() for double traversal)
+	float4 f_node() const { return make_float4((float)x, (float)y, (float)z, 0); }
 };
 
 struct edge
@@ -138,15 +203,481 @@ struct tetrahedra
 	int32_t adjtet1, adjtet2, adjtet3, adjtet4;
 };
 
+//----------------------- memory -----------------------------------------------------------------
+
+// hint to load the cache line of p, no effect on compilers without prefetch support
+#if defined(__GNUC__) || defined(__clang__)
+#define TET_PREFETCH(p) __builtin_prefetch((const void*)(p))
+#elif defined(_MSC_VER)
+#include <xmmintrin.h>
+#define TET_PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define TET_PREFETCH(p) ((void)0)
+#endif
+
+void* tet_aligned_alloc(size_t bytes, size_t alignment = 64)
+{
+#ifdef _WIN32
+	return _aligned_malloc(bytes, alignment);
+#else
+#if defined(TETGEN_STB_HUGEPAGES) && defined(MADV_HUGEPAGE)
+	// blocks of 2 MB and more are placed on huge page boundaries and advised to use transparent huge pages
+	const size_t hugepage = 2u << 20;
+	if (bytes >= hugepage) alignment = hugepage;
+#endif
+	void* p = nullptr;
+	if (posix_memalign(&p, alignment, bytes) != 0) return nullptr;
+#if defined(TETGEN_STB_HUGEPAGES) && defined(MADV_HUGEPAGE)
+	if (bytes >= hugepage) madvise(p, (bytes + hugepage - 1) / hugepage * hugepage, MADV_HUGEPAGE);
+#endif
+	return p;
+#endif
+}
+
+void tet_aligned_free(void* p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+/* 64-byte aligned allocator for the tetrahedra_mesh arrays */
+/* define TETGEN_STB_HUGEPAGES to back large arrays with transparent huge pages (Linux), */
+/* or TETGEN_STB_ALLOCATOR to the name of your own allocator template before including this file */
+template <typename T>
+struct tet_allocator
+{
+	typedef T value_type;
+
+	tet_allocator() {}
+	template <typename U> tet_allocator(const tet_allocator<U>&) {}
+
+	T* allocate(size_t n)
+	{
+		void* p = tet_aligned_alloc(n * sizeof(T));
+		if (p == nullptr) throw std::bad_alloc();
+		return (T*)p;
+	}
+	void deallocate(T* p, size_t) { tet_aligned_free(p); }
+};
+
+template <typename T, typename U> bool operator==(const tet_allocator<T>&, const tet_allocator<U>&) { return true; }
+template <typename T, typename U> bool operator!=(const tet_allocator<T>&, const tet_allocator<U>&) { return false; }
+
+#ifndef TETGEN_STB_ALLOCATOR
+#define TETGEN_STB_ALLOCATOR tet_allocator
+#endif
+
+// contiguous indexed storage of the loaded mesh
+template <typename T> using tet_array = std::vector<T, TETGEN_STB_ALLOCATOR<T>>;
+
+//----------------------- file reading -----------------------------------------------------------------
+
+/* read-only memory mapping of a whole tetgen file */
+struct mapped_file
+{
+	const char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int fd = -1;
+#endif
+
+	mapped_file() {}
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+	~mapped_file() { close(); }
+
+	bool open(const std::string &filename);
+	void close();
+};
+
+bool mapped_file::open(const std::string &filename)
+{
+	close();
+#ifdef _WIN32
+	file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER filesize;
+	if (!GetFileSizeEx(file, &filesize)) { close(); return false; }
+	size = (size_t)filesize.QuadPart;
+	if (size == 0) return true;
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) { close(); return false; }
+	data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr) { close(); return false; }
+#else
+	fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0) { close(); return false; }
+	size = (size_t)st.st_size;
+	if (size == 0) return true;
+	void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) { close(); return false; }
+	madvise(p, size, MADV_SEQUENTIAL);
+	data = (const char*)p;
+#endif
+	return true;
+}
+
+void mapped_file::close()
+{
+#ifdef _WIN32
+	if (data != nullptr) UnmapViewOfFile(data);
+	if (mapping != NULL) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (data != nullptr) munmap((void*)data, size);
+	if (fd >= 0) ::close(fd);
+	fd = -1;
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+/* allocation-free tokenizer over the records of a tetgen file */
+/* a record is one line; empty lines and '#' comments are skipped */
+struct tet_tokenizer
+{
+	const char* cur;
+	const char* end;
+
+	tet_tokenizer(const char* begin, const char* stop) : cur(begin), end(stop) {}
+	explicit tet_tokenizer(const mapped_file &file) : cur(file.data), end(file.data + file.size) {}
+
+	bool next_line();
+	void skip_line();
+	bool read_int(int32_t &v);
+	bool read_float(float &v);
+	bool read_double(double &v);
+	int read_ints(int32_t* ints, int maxcount);
+
+private:
+	void skip_blanks() { while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == ',')) cur++; }
+	bool at_token_end() const { return cur >= end || *cur == ' ' || *cur == '\t' || *cur == '\r' || *cur == '\n' || *cur == ',' || *cur == '#'; }
+};
+
+// positions cur at the first token of the next record, returns false at end of file
+bool tet_tokenizer::next_line()
+{
+	while (cur < end)
+	{
+		skip_blanks();
+		if (cur >= end) return false;
+		if (*cur == '\n') { cur++; continue; }
+		if (*cur == '#') { skip_line(); continue; }
+		return true;
+	}
+	return false;
+}
+
+void tet_tokenizer::skip_line()
+{
+	const char* nl = (const char*)memchr(cur, '\n', end - cur);
+	cur = (nl != nullptr) ? nl + 1 : end;
+}
+
+bool tet_tokenizer::read_int(int32_t &v)
+{
+	skip_blanks();
+	const char* p = cur;
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+')) { neg = (*p == '-'); p++; }
+	if (p >= end || *p < '0' || *p > '9') return false;
+	int64_t r = 0;
+	while (p < end && *p >= '0' && *p <= '9') { r = r * 10 + (*p - '0'); p++; }
+	cur = p;
+	if (!at_token_end()) return false; // not an integer, e.g. a float attribute
+	v = (int32_t)(neg ? -r : r);
+	return true;
+}
+
+bool tet_tokenizer::read_float(float &v)
+{
+	double d;
+	if (!read_double(d)) return false;
+	v = (float)d;
+	return true;
+}
+
+/* correctly rounded: mantissas up to 2^53 with |exp10| <= 22 are exact in one rounding, */
+/* everything else goes through strtod */
+bool tet_tokenizer::read_double(double &v)
+{
+	static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	skip_blanks();
+	const char* start = cur;
+	const char* p = cur;
+	bool neg = false;
+	if (p < end && (*p == '-' || *p == '+')) { neg = (*p == '-'); p++; }
+	uint64_t mantissa = 0;
+	int digits = 0, exp10 = 0;
+	bool any = false;
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa != 0) digits++; }
+		else exp10++;
+		any = true; p++;
+	}
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa != 0) digits++; exp10--; }
+			any = true; p++;
+		}
+	}
+	if (!any) return false;
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* q = p + 1;
+		bool eneg = false;
+		if (q < end && (*q == '-' || *q == '+')) { eneg = (*q == '-'); q++; }
+		if (q < end && *q >= '0' && *q <= '9')
+		{
+			int e = 0;
+			while (q < end && *q >= '0' && *q <= '9') { if (e < 10000) e = e * 10 + (*q - '0'); q++; }
+			exp10 += eneg ? -e : e;
+			p = q;
+		}
+	}
+	cur = p;
+	if (!at_token_end()) return false;
+	if (mantissa > (1ull << 53) || exp10 < -22 || exp10 > 22)
+	{
+		// the token is not null terminated
+		std::string token(start, p);
+		v = strtod(token.c_str(), nullptr);
+		return true;
+	}
+	double r = (double)mantissa;
+	if (exp10 < 0) r /= pow10[-exp10];
+	else if (exp10 > 0) r *= pow10[exp10];
+	v = neg ? -r : r;
+	return true;
+}
+
+// reads up to maxcount integers of the current record and moves to the next line, returns the number read
+int tet_tokenizer::read_ints(int32_t* ints, int maxcount)
+{
+	int n = 0;
+	int32_t v;
+	while (n < maxcount && read_int(v)) ints[n++] = v;
+	skip_line();
+	return n;
+}
+
+double tet_mb_per_s(size_t bytes, std::chrono::steady_clock::time_point start)
+{
+	double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return (s > 0.0) ? bytes / s / 1e6 : 0.0;
+}
+
+// 0 means all hardware threads
+unsigned tet_thread_count(unsigned requested)
+{
+	if (requested != 0) return requested;
+	unsigned n = std::thread::hardware_concurrency();
+	return (n != 0) ? n : 1;
+}
+
+/* calls fn(begin, end) on up to 'threads' threads, each with a contiguous part of [0, count) */
+template <typename F>
+void tet_parallel_for(size_t count, unsigned threads, F fn)
+{
+	threads = tet_thread_count(threads);
+	if (count < 65536 || threads == 1) { fn((size_t)0, count); return; }
+
+	std::vector<std::thread> pool;
+	for (unsigned i = 0; i < threads; i++)
+	{
+		size_t begin = count * i / threads, end = count * (i + 1) / threads;
+		pool.emplace_back([=, &fn]() { fn(begin, end); });
+	}
+	for (auto &t : pool) t.join();
+}
+
+/* calls fn(begin, end) for every chunk of 'chunk' items of [0, count) on up to 'threads' threads */
+/* each thread owns a contiguous range of chunks; when it is done, it steals chunks from the ranges of */
+/* the other threads, so chunks of very different cost stay balanced */
+template <typename F>
+void tet_parallel_chunks(size_t count, size_t chunk, unsigned threads, F fn)
+{
+	if (chunk == 0) chunk = 1;
+	size_t chunks = (count + chunk - 1) / chunk;
+	threads = tet_thread_count(threads);
+	if (threads > chunks) threads = (unsigned)chunks;
+	if (threads <= 1)
+	{
+		for (size_t c = 0; c < chunks; c++) fn(c * chunk, std::min(count, (c + 1) * chunk));
+		return;
+	}
+
+	struct alignas(64) chunk_range { std::atomic<size_t> next; size_t end; };
+	std::unique_ptr<chunk_range[]> ranges(new chunk_range[threads]);
+	for (unsigned i = 0; i < threads; i++)
+	{
+		ranges[i].next = chunks * i / threads;
+		ranges[i].end = chunks * (i + 1) / threads;
+	}
+	auto work = [&](unsigned self)
+	{
+		for (unsigned k = 0; k < threads; k++) // own range first, then the others
+		{
+			chunk_range &r = ranges[(self + k) % threads];
+			for (size_t c = r.next++; c < r.end; c = r.next++) fn(c * chunk, std::min(count, (c + 1) * chunk));
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned i = 1; i < threads; i++) pool.emplace_back(work, i);
+	work(0);
+	for (auto &t : pool) t.join();
+}
+
+/* threads that stay alive for many short parallel loops (the waves of traverse_stream): run() hands */
+/* out the chunks of [0, count) to the workers and the calling thread and returns when all are done */
+struct tet_thread_team
+{
+	std::vector<std::thread> pool;
+	std::mutex lock;
+	std::condition_variable wake, idle;
+	std::function<void(size_t, size_t)> job;
+	std::atomic<size_t> next;
+	size_t count = 0, chunk = 1;
+	uint64_t generation = 0;
+	unsigned busy = 0;
+	bool quit = false;
+
+	explicit tet_thread_team(unsigned threads)
+	{
+		threads = tet_thread_count(threads);
+		for (unsigned i = 1; i < threads; i++) pool.emplace_back([this]() { work(); });
+	}
+	~tet_thread_team()
+	{
+		{
+			std::lock_guard<std::mutex> g(lock);
+			quit = true;
+		}
+		wake.notify_all();
+		for (auto &t : pool) t.join();
+	}
+
+	// takes chunks of the current job until none is left
+	void take()
+	{
+		for (size_t c = next++; c * chunk < count; c = next++) job(c * chunk, std::min(count, (c + 1) * chunk));
+	}
+
+	void work()
+	{
+		uint64_t seen = 0;
+		std::unique_lock<std::mutex> g(lock);
+		for (;;)
+		{
+			wake.wait(g, [&]() { return quit || generation != seen; });
+			if (quit) return;
+			seen = generation;
+			g.unlock();
+			take();
+			g.lock();
+			if (--busy == 0) idle.notify_one();
+		}
+	}
+
+	/* calls fn(begin, end) for every chunk of 'chunk_size' items of [0, n), on the calling thread */
+	/* alone if 'parallel' is false */
+	void run(size_t n, size_t chunk_size, bool parallel, std::function<void(size_t, size_t)> fn)
+	{
+		if (chunk_size == 0) chunk_size = 1;
+		if (pool.empty() || !parallel || n <= chunk_size)
+		{
+			for (size_t b = 0; b < n; b += chunk_size) fn(b, std::min(n, b + chunk_size));
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> g(lock);
+			job = fn;
+			count = n;
+			chunk = chunk_size;
+			next = 0;
+			busy = (unsigned)pool.size();
+			generation++;
+		}
+		wake.notify_all();
+		take();
+		std::unique_lock<std::mutex> g(lock);
+		idle.wait(g, [&]() { return busy == 0; });
+	}
+};
+
+/* parses the remaining records of tok with record(tokenizer), on up to 'threads' threads */
+/* the byte range is split at newline boundaries, so every record is seen by exactly one thread */
+/* record() must consume its line and may only write to the slot given by the record's own index */
+/* with a single thread at most 'limit' records are parsed; returns the number of records */
+template <typename F>
+uint32_t tet_parse_records(tet_tokenizer &tok, unsigned threads, uint32_t limit, F record)
+{
+	size_t bytes = tok.end - tok.cur;
+	threads = tet_thread_count(threads);
+	if (bytes < (1u << 20)) threads = 1; // thread start-up is not worth it for small files
+
+	if (threads == 1)
+	{
+		uint32_t num = 0;
+		while (num < limit && tok.next_line()) { record(tok); num++; }
+		return num;
+	}
+
+	std::vector<const char*> bounds(threads + 1);
+	bounds[0] = tok.cur;
+	bounds[threads] = tok.end;
+	for (unsigned i = 1; i < threads; i++)
+	{
+		const char* p = tok.cur + bytes * i / threads;
+		if (p < bounds[i - 1]) p = bounds[i - 1];
+		const char* nl = (const char*)memchr(p, '\n', tok.end - p);
+		bounds[i] = (nl != nullptr) ? nl + 1 : tok.end;
+	}
+
+	std::vector<uint32_t> counts(threads, 0);
+	std::vector<std::thread> pool;
+	for (unsigned i = 0; i < threads; i++)
+	{
+		pool.emplace_back([&, i]()
+		{
+			tet_tokenizer chunk(bounds[i], bounds[i + 1]);
+			while (chunk.next_line()) { record(chunk); counts[i]++; }
+		});
+	}
+	for (auto &t : pool) t.join();
+	tok.cur = tok.end;
+
+	uint32_t num = 0;
+	for (uint32_t c : counts) num += c;
+	return num;
+}
+
 class tetrahedra_mesh
 {
 public:
 	uint32_t tetnum, nodenum, facenum, edgenum;
-	std::deque<tetrahedra>tetrahedras;
-	std::deque<node>nodes;
-	std::deque<face>faces;
-	std::deque<edge>edges;
+	tet_array<tetrahedra>tetrahedras;
+	tet_array<node>nodes;
+	tet_array<face>faces;
+	tet_array<edge>edges;
 	uint32_t max = 1000000000;
+	uint32_t threads = 1; // threads parsing a single .ele/.node file, 0 = all cores
 
 	void load_tet_neigh(std::string filename);
 	void load_tet_ele(std::string filename);
@@ -154,36 +685,54 @@ public:
 	void load_tet_face(std::string filename);
 	void load_tet_t2f(std::string filename);
 	void load_tet_edge(std::string filename);
+
+	bool load_mesh(std::string basename);
 };
 
+// reads the record count from the first line of a tetgen file, returns false if it cannot be opened
+bool read_tet_header(const std::string &filename, uint32_t &count)
+{
+	mapped_file myfile;
+	int32_t ints[8];
+	if (!myfile.open(filename)) return false;
+	tet_tokenizer tok(myfile);
+	if (!tok.next_line() || tok.read_ints(ints, 8) < 1) return false;
+	count = ints[0];
+	return true;
+}
+
 void tetrahedra_mesh::load_tet_ele(std::string filename)
 {
 	uint32_t num = 0;
 	tetrahedra tet1;
-	std::string line;
-	std::ifstream myfile(filename);
-	if (myfile.is_open())
+	mapped_file myfile;
+	auto start = std::chrono::steady_clock::now();
+	if (myfile.open(filename))
 	{
-		while (std::getline(myfile, line) && num<max) // Nur die ersten tausend Zeilen einlesen
+		tet_tokenizer tok(myfile);
+		int32_t header[8];
+		if (tok.next_line() && num<max && tok.read_ints(header, 8) >= 1) //Erste Zeile
 		{
-			std::stringstream in(line);
-			std::vector<int32_t> ints;
-			copy(std::istream_iterator<int32_t, char>(in), std::istream_iterator<int32_t, char>(), back_inserter(ints));
-			if (num == 0) //Erste Zeile
-			{
-				tetnum = ints.at(0); //In erster Zeile der .ele-Datei ist Anzahl der Tetraheder abgelegt
-				tetrahedras.resize(tetnum, tet1); //Tetrahedra-Deque füllen
-			}
-			else if (ints.size() != NULL) // restliche Zeilen
-			{
-				tetrahedras.at(ints.at(0)).number = ints.at(0); //nummer von aktuellem tetrahedra
-				tetrahedras.at(ints.at(0)).nindex1 = ints.at(1);
-				tetrahedras.at(ints.at(0)).nindex2 = ints.at(2);
-				tetrahedras.at(ints.at(0)).nindex3 = ints.at(3);
-				tetrahedras.at(ints.at(0)).nindex4 = ints.at(4);
-			}
+			tetnum = header[0]; //In erster Zeile der .ele-Datei ist Anzahl der Tetraheder abgelegt
+			if (tetrahedras.size() != tetnum) tetrahedras.resize(tetnum, tet1); //Tetrahedra-Array füllen
 			num++;
+
+			// restliche Zeilen, in parallel only when 'max' does not cut the file short
+			unsigned nthreads = (tetnum < max - num) ? threads : 1;
+			num += tet_parse_records(tok, nthreads, max - num, [this](tet_tokenizer &t)
+			{
+				int32_t ints[8];
+				int n = t.read_ints(ints, 8);
+				if (n < 5 || (uint32_t)ints[0] >= tetnum) return;
+				tetrahedra &tet = tetrahedras[ints[0]];
+				tet.number = ints[0]; //nummer von aktuellem tetrahedra
+				tet.nindex1 = ints[1];
+				tet.nindex2 = ints[2];
+				tet.nindex3 = ints[3];
+				tet.nindex4 = ints[4];
+			});
 		}
+		fprintf_s(stderr, "Parsed .ele file with %.1f MB/s \n", tet_mb_per_s(myfile.size, start));
 		myfile.close();
 	}
 	else std::cout << "Unable to open .ele file";
@@ -194,24 +743,26 @@ void tetrahedra_mesh::load_tet_ele(std::string filename)
 void tetrahedra_mesh::load_tet_neigh(std::string filename)
 {
 	uint32_t num = 0;
-	std::string line;
-	std::ifstream myfile(filename);
-	if (myfile.is_open())
+	mapped_file myfile;
+	auto start = std::chrono::steady_clock::now();
+	if (myfile.open(filename))
 	{
-		while (std::getline(myfile, line) && num<max) // Nur die ersten tausend Zeilen einlesen
+		tet_tokenizer tok(myfile);
+		int32_t ints[8];
+		while (tok.next_line() && num<max) // Nur die ersten tausend Zeilen einlesen
 		{
-			std::stringstream in(line);
-			std::vector<int32_t> ints;
-			copy(std::istream_iterator<int32_t, char>(in), std::istream_iterator<int32_t, char>(), back_inserter(ints));
-			if (num != 0 && ints.size() != NULL)
+			int n = tok.read_ints(ints, 8);
+			if (num != 0 && n >= 5 && (uint32_t)ints[0] < tetrahedras.size())
 			{
-				tetrahedras.at(ints.at(0)).adjtet1 = ints.at(1);
-				tetrahedras.at(ints.at(0)).adjtet2 = ints.at(2);
-				tetrahedras.at(ints.at(0)).adjtet3 = ints.at(3);
-				tetrahedras.at(ints.at(0)).adjtet4 = ints.at(4);
+				tetrahedra &tet = tetrahedras[ints[0]];
+				tet.adjtet1 = ints[1];
+				tet.adjtet2 = ints[2];
+				tet.adjtet3 = ints[3];
+				tet.adjtet4 = ints[4];
 			}
 			num++;
 		}
+		fprintf_s(stderr, "Parsed .neigh file with %.1f MB/s \n", tet_mb_per_s(myfile.size, start));
 		myfile.close();
 	}
 	else std::cout << "Unable to open .neigh file";
@@ -224,29 +775,36 @@ void tetrahedra_mesh::load_tet_node(std::string filename)
 {
 	uint32_t num = 0;
 	node nd1;
-	std::string line;
-	std::ifstream myfile(filename);
-	if (myfile.is_open())
+	mapped_file myfile;
+	auto start = std::chrono::steady_clock::now();
+	if (myfile.open(filename))
 	{
-		while (std::getline(myfile, line) && num<max) // Nur die ersten tausend Zeilen einlesen
+		tet_tokenizer tok(myfile);
+		int32_t ints[8];
+		if (tok.next_line() && num<max && tok.read_ints(ints, 8) >= 1) //Erste Zeile
 		{
-			std::stringstream in(line);
-			std::vector<float> ints;
-			copy(std::istream_iterator<float, char>(in), std::istream_iterator<float, char>(), back_inserter(ints));
-			if (num == 0) //Erste Zeile
-			{
-				nodenum = int(ints.at(0)); //In erster Zeile der .ele-Datei ist Anzahl der Tetraheder abgelegt
-				nodes.resize(nodenum, nd1); //Tetrahedra-Deque füllen
-			}
-			else if (ints.size() != NULL) // restliche Zeilen
-			{
-				nodes.at((int)ints.at(0)).index = ints.at(0);
-				nodes.at((int)ints.at(0)).x = ints.at(1);
-				nodes.at((int)ints.at(0)).y = ints.at(2);
-				nodes.at((int)ints.at(0)).z = ints.at(3);
-			}
+			nodenum = ints[0]; //In erster Zeile der .node-Datei ist Anzahl der Knoten abgelegt
+			if (nodes.size() != nodenum) nodes.resize(nodenum, nd1); //Node-Array füllen
 			num++;
+
+			// restliche Zeilen, in parallel only when 'max' does not cut the file short
+			unsigned nthreads = (nodenum < max - num) ? threads : 1;
+			num += tet_parse_records(tok, nthreads, max - num, [this](tet_tokenizer &t)
+			{
+				int32_t index;
+				double x, y, z;
+				if (t.read_int(index) && t.read_double(x) && t.read_double(y) && t.read_double(z) && (uint32_t)index < nodenum)
+				{
+					node &nd = nodes[index];
+					nd.index = index;
+					nd.x = x;
+					nd.y = y;
+					nd.z = z;
+				}
+				t.skip_line();
+			});
 		}
+		fprintf_s(stderr, "Parsed .node file with %.1f MB/s \n", tet_mb_per_s(myfile.size, start));
 		myfile.close();
 	}
 	else std::cout << "Unable to open .node file";
@@ -258,34 +816,35 @@ void tetrahedra_mesh::load_tet_face(std::string filename)
 {
 	uint32_t num = 0;
 	face fc1;
-	std::string line;
-	std::ifstream myfile(filename);
-	if (myfile.is_open())
+	mapped_file myfile;
+	auto start = std::chrono::steady_clock::now();
+	if (myfile.open(filename))
 	{
-		while (std::getline(myfile, line) && num<max) // Nur die ersten tausend Zeilen einlesen
+		tet_tokenizer tok(myfile);
+		int32_t ints[8];
+		while (tok.next_line() && num<max) // Nur die ersten tausend Zeilen einlesen
 		{
-			std::stringstream in(line);
-			std::vector<int32_t> ints;
-			copy(std::istream_iterator<int32_t, char>(in), std::istream_iterator<int32_t, char>(), back_inserter(ints));
+			int n = tok.read_ints(ints, 8);
 			if (num == 0) //Erste Zeile
 			{
-				facenum = int(ints.at(0)); //In erster Zeile der .ele-Datei ist Anzahl der Tetraheder abgelegt
-				faces.resize(facenum, fc1); //Tetrahedra-Deque füllen
+				if (n < 1) break;
+				facenum = ints[0]; //In erster Zeile der .ele-Datei ist Anzahl der Tetraheder abgelegt
+				if (faces.size() != facenum) faces.resize(facenum, fc1); //Face-Array füllen
 			}
-			else if (ints.size() != NULL) // restliche Zeilen
+			else if (n >= 4 && (uint32_t)ints[0] < facenum) // restliche Zeilen
 			{
-				faces.at(ints.at(0)).index = ints.at(0);
-				faces.at(ints.at(0)).node_a = ints.at(1);
-				faces.at(ints.at(0)).node_b = ints.at(2);
-				faces.at(ints.at(0)).node_c = ints.at(3);
-
-
-
-				if (ints.at(5) == -1 || ints.at(6) == -1) { faces.at(ints.at(0)).face_is_wall = true; }
-				else if (ints.at(4) == -1) faces.at(ints.at(0)).face_is_constrained = true;
+				face &fc = faces[ints[0]];
+				fc.index = ints[0];
+				fc.node_a = ints[1];
+				fc.node_b = ints[2];
+				fc.node_c = ints[3];
+
+				if (n >= 7 && (ints[5] == -1 || ints[6] == -1)) { fc.face_is_wall = true; }
+				else if (n >= 5 && ints[4] == -1) fc.face_is_constrained = true;
 			}
 			num++;
 		}
+		fprintf_s(stderr, "Parsed .face file with %.1f MB/s \n", tet_mb_per_s(myfile.size, start));
 		myfile.close();
 	}
 	else std::cout << "Unable to open .face file";
@@ -298,28 +857,31 @@ void tetrahedra_mesh::load_tet_edge(std::string filename)
 {
 	uint32_t num = 0;
 	edge ed1;
-	std::string line;
-	std::ifstream myfile(filename);
-	if (myfile.is_open())
+	mapped_file myfile;
+	auto start = std::chrono::steady_clock::now();
+	if (myfile.open(filename))
 	{
-		while (std::getline(myfile, line) && num<max) // Nur die ersten tausend Zeilen einlesen
+		tet_tokenizer tok(myfile);
+		int32_t ints[8];
+		while (tok.next_line() && num<max) // Nur die ersten tausend Zeilen einlesen
 		{
-			std::stringstream in(line);
-			std::vector<int32_t> ints;
-			copy(std::istream_iterator<int32_t, char>(in), std::istream_iterator<int32_t, char>(), back_inserter(ints));
+			int n = tok.read_ints(ints, 8);
 			if (num == 0) //Erste Zeile
 			{
-				edgenum = int(ints.at(0)); //In erster Zeile der .ele-Datei ist Anzahl der Tetraheder abgelegt
-				edges.resize(edgenum, ed1); //Tetrahedra-Deque füllen
+				if (n < 1) break;
+				edgenum = ints[0]; //In erster Zeile der .ele-Datei ist Anzahl der Tetraheder abgelegt
+				if (edges.size() != edgenum) edges.resize(edgenum, ed1); //Edge-Array füllen
 			}
-			else if (ints.size() != NULL) // restliche Zeilen
+			else if (n >= 3 && (uint32_t)ints[0] < edgenum) // restliche Zeilen
 			{
-				edges.at(ints.at(0)).index = ints.at(0);
-				edges.at(ints.at(0)).node1 = ints.at(1);
-				edges.at(ints.at(0)).node1 = ints.at(2);
+				edge &ed = edges[ints[0]];
+				ed.index = ints[0];
+				ed.node1 = ints[1];
+				ed.node2 = ints[2];
 			}
 			num++;
 		}
+		fprintf_s(stderr, "Parsed .edge file with %.1f MB/s \n", tet_mb_per_s(myfile.size, start));
 		myfile.close();
 	}
 	else std::cout << "Unable to open .edge file";
@@ -330,181 +892,1871 @@ void tetrahedra_mesh::load_tet_edge(std::string filename)
 void tetrahedra_mesh::load_tet_t2f(std::string filename)
 {
 	uint32_t num = 0;
-	std::string line;
-	std::ifstream myfile(filename);
-	if (myfile.is_open())
+	mapped_file myfile;
+	auto start = std::chrono::steady_clock::now();
+	if (myfile.open(filename))
 	{
-		while (std::getline(myfile, line) && num<max) // Nur die ersten tausend Zeilen einlesen
+		tet_tokenizer tok(myfile);
+		int32_t ints[8];
+		int32_t base = 1; // .t2f has no header and counts tetrahedra from 1, or from 0 in newer tetgen versions
+		while (tok.next_line() && num<max) // Nur die ersten tausend Zeilen einlesen
 		{
-			std::stringstream in(line);
-			std::vector<int32_t> ints;
-			copy(std::istream_iterator<int32_t, char>(in), std::istream_iterator<int32_t, char>(), back_inserter(ints));
-
-			if (ints.size() != NULL) // alle Zeilen
+			int n = tok.read_ints(ints, 8);
+			if (n >= 5) // alle Zeilen
 			{
-				tetrahedras.at(ints.at(0) - 1).findex1 = ints.at(1);
-				tetrahedras.at(ints.at(0) - 1).findex2 = ints.at(2);
-				tetrahedras.at(ints.at(0) - 1).findex3 = ints.at(3);
-				tetrahedras.at(ints.at(0) - 1).findex4 = ints.at(4);
+				if (num == 0 && ints[0] == 0) base = 0;
+				if ((uint32_t)(ints[0] - base) >= tetrahedras.size()) { num++; continue; }
+				tetrahedra &tet = tetrahedras[ints[0] - base];
+				tet.findex1 = ints[1];
+				tet.findex2 = ints[2];
+				tet.findex3 = ints[3];
+				tet.findex4 = ints[4];
 			}
 			num++;
 		}
+		fprintf_s(stderr, "Parsed .t2f file with %.1f MB/s \n", tet_mb_per_s(myfile.size, start));
 		myfile.close();
 	}
 	else std::cout << "Unable to open .t2f file";
 	fprintf_s(stderr, "Total number of Tetrahedra in .t2f-file: %u \n", num);
 }
 
-//--------------------------------------------------------------------------------------------------------------------------------------
+/* brings every tetrahedron into the local order the exit tests rely on: positive orientation, */
+/* det(B - A, C - A, D - A) > 0 as tetgen writes it, and findex[i], adjtet[i] being the face and */
+/* neighbour opposite to node i. Faces and neighbours are placed by their nodes, not by the column order */
+/* of .t2f and .neigh. Returns false if faces or neighbours of a tetrahedron do not match its nodes (its */
+/* slots are then left as loaded) or a neighbour does not link back. load_mesh() calls it; call it */
+/* yourself after loading the files one by one */
+bool normalize_tet_order(tetrahedra_mesh &tetmesh, unsigned threads = 1)
+{
+	uint32_t tetnum = (uint32_t)tetmesh.tetrahedras.size(), nodenum = (uint32_t)tetmesh.nodes.size(), facenum = (uint32_t)tetmesh.faces.size();
+	std::atomic<uint32_t> flipped(0), moved(0), bad(0);
+	auto valid_nodes = [&](const tetrahedra &t)
+	{
+		int32_t n[4] = { t.nindex1, t.nindex2, t.nindex3, t.nindex4 };
+		for (int k = 0; k < 4; k++) if (n[k] < 0 || (uint32_t)n[k] >= nodenum) return false;
+		return true;
+	};
 
+	// orientation first, swapping C and D keeps the node set the neighbours are matched by
+	tet_parallel_for(tetnum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			tetrahedra &t = tetmesh.tetrahedras[i];
+			if (!valid_nodes(t)) continue;
+			const node &A = tetmesh.nodes[t.nindex1], &B = tetmesh.nodes[t.nindex2], &C = tetmesh.nodes[t.nindex3], &D = tetmesh.nodes[t.nindex4];
+			double bx = (double)B.x - A.x, by = (double)B.y - A.y, bz = (double)B.z - A.z;
+			double cx = (double)C.x - A.x, cy = (double)C.y - A.y, cz = (double)C.z - A.z;
+			double dx = (double)D.x - A.x, dy = (double)D.y - A.y, dz = (double)D.z - A.z;
+			double det = bx * (cy * dz - cz * dy) - by * (cx * dz - cz * dx) + bz * (cx * dy - cy * dx);
+			if (det < 0) { std::swap(t.nindex3, t.nindex4); flipped++; }
+		}
+	});
 
-bool IsPointInTetrahedron(float4 v1, float4 v2, float4 v3, float4 v4, float4 p)
-{
-		// https://stackoverflow.com/questions/25179693/how-to-check-whether-the-point-is-in-the-tetrahedron-or-not/25180158#25180158
-		return SameSide(v1, v2, v3, v4, p) &&
-		SameSide(v2, v3, v4, v1, p) &&
-		SameSide(v3, v4, v1, v2, p) &&
-		SameSide(v4, v1, v2, v3, p);
-}
+	// faces and neighbours to the slot of the node they do not contain
+	tet_parallel_for(tetnum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			tetrahedra &t = tetmesh.tetrahedras[i];
+			if (!valid_nodes(t)) { bad++; continue; }
+			int32_t n[4] = { t.nindex1, t.nindex2, t.nindex3, t.nindex4 };
+			// slot of the one node of t missing in 'other', -1 unless the other three are all in it
+			auto opposite = [&](const int32_t* other, int count)
+			{
+				int slot = -1, missing = 0;
+				for (int k = 0; k < 4; k++)
+				{
+					bool found = false;
+					for (int j = 0; j < count; j++) found |= (other[j] == n[k]);
+					if (!found) { slot = k; missing++; }
+				}
+				return (missing == 1) ? slot : -1;
+			};
+
+			bool ok = true;
+			int32_t f[4] = { t.findex1, t.findex2, t.findex3, t.findex4 }, nf[4] = { -1, -1, -1, -1 };
+			if (facenum > 0)
+			{
+				for (int k = 0; k < 4 && ok; k++)
+				{
+					if (f[k] < 0 || (uint32_t)f[k] >= facenum) { ok = false; break; }
+					const face &fc = tetmesh.faces[f[k]];
+					int32_t fn[3] = { (int32_t)fc.node_a, (int32_t)fc.node_b, (int32_t)fc.node_c };
+					int slot = opposite(fn, 3);
+					if (slot < 0 || nf[slot] != -1) ok = false;
+					else nf[slot] = f[k];
+				}
+			}
+			else for (int k = 0; k < 4; k++) nf[k] = f[k];
 
-bool IsPointInThisTet(mesh2* mesh, float4 v, int32_t tet)
-{
-	float4 nodes[4] = {
-		make_float4(mesh->n_x[mesh->t_nindex1[tet]], mesh->n_y[mesh->t_nindex1[tet]], mesh->n_z[mesh->t_nindex1[tet]], 0),
-		make_float4(mesh->n_x[mesh->t_nindex2[tet]], mesh->n_y[mesh->t_nindex2[tet]], mesh->n_z[mesh->t_nindex2[tet]], 0),
-		make_float4(mesh->n_x[mesh->t_nindex3[tet]], mesh->n_y[mesh->t_nindex3[tet]], mesh->n_z[mesh->t_nindex3[tet]], 0),
-		make_float4(mesh->n_x[mesh->t_nindex4[tet]], mesh->n_y[mesh->t_nindex4[tet]], mesh->n_z[mesh->t_nindex4[tet]], 0) };
-	if (IsPointInTetrahedron(nodes[0], nodes[1], nodes[2], nodes[3], v) == true) return true;
-	else return false;
-}
+			int32_t a[4] = { t.adjtet1, t.adjtet2, t.adjtet3, t.adjtet4 }, na[4] = { -1, -1, -1, -1 };
+			for (int k = 0; k < 4 && ok; k++)
+			{
+				if (a[k] == -1) continue;
+				if (a[k] < 0 || (uint32_t)a[k] >= tetnum || !valid_nodes(tetmesh.tetrahedras[a[k]])) { ok = false; break; }
+				const tetrahedra &nb = tetmesh.tetrahedras[a[k]];
+				int32_t nn[4] = { nb.nindex1, nb.nindex2, nb.nindex3, nb.nindex4 };
+				int slot = opposite(nn, 4);
+				if (slot < 0 || na[slot] != -1) ok = false;
+				else na[slot] = a[k];
+			}
+			if (!ok) { bad++; continue; }
 
-int32_t GetTetrahedraFromPoint(mesh2* mesh, float4 p)
-{
-		for (int i=0;i<mesh->tetnum;i++)
-    {
-			float4 v1 = make_float4(mesh->n_x[mesh->t_nindex1[i]], mesh->n_y[mesh->t_nindex1[i]], mesh->n_z[mesh->t_nindex1[i]], 0);
-			float4 v2 = make_float4(mesh->n_x[mesh->t_nindex2[i]], mesh->n_y[mesh->t_nindex2[i]], mesh->n_z[mesh->t_nindex2[i]], 0);
-			float4 v3 = make_float4(mesh->n_x[mesh->t_nindex3[i]], mesh->n_y[mesh->t_nindex3[i]], mesh->n_z[mesh->t_nindex3[i]], 0);
-			float4 v4 = make_float4(mesh->n_x[mesh->t_nindex4[i]], mesh->n_y[mesh->t_nindex4[i]], mesh->n_z[mesh->t_nindex4[i]], 0);
-			if (IsPointInTetrahedron(v1, v2, v3, v4, p) == true) return i;
+			if (nf[0] != f[0] || nf[1] != f[1] || nf[2] != f[2] || nf[3] != f[3] || na[0] != a[0] || na[1] != a[1] || na[2] != a[2] || na[3] != a[3]) moved++;
+			t.findex1 = nf[0]; t.findex2 = nf[1]; t.findex3 = nf[2]; t.findex4 = nf[3];
+			t.adjtet1 = na[0]; t.adjtet2 = na[1]; t.adjtet3 = na[2]; t.adjtet4 = na[3];
 		}
-}
+	});
 
-BBox init_BBox(mesh2* mesh)
-{
-	BBox boundingbox;
-	boundingbox.min = make_float4(-inf, -inf, -inf, 0);
-	boundingbox.max = make_float4(inf, inf, inf, 0);
-	for (uint32_t i = 0; i < mesh->nodenum; i++)
+	// every neighbour has to link back
+	tet_parallel_for(tetnum, threads, [&](size_t begin, size_t end)
 	{
-		if (boundingbox.min.x < mesh->n_x[i])  boundingbox.min.x = mesh->n_x[i];
-		if (boundingbox.max.x > mesh->n_x[i])  boundingbox.max.x = mesh->n_x[i];
-		if (boundingbox.min.y < mesh->n_y[i])  boundingbox.min.y = mesh->n_y[i];
-		if (boundingbox.max.y > mesh->n_y[i])  boundingbox.max.y = mesh->n_y[i];
-		if (boundingbox.min.z < mesh->n_z[i])  boundingbox.min.z = mesh->n_z[i];
-		if (boundingbox.max.z > mesh->n_z[i])  boundingbox.max.z = mesh->n_z[i];
-	}
-	return boundingbox;
+		for (size_t i = begin; i < end; i++)
+		{
+			const tetrahedra &t = tetmesh.tetrahedras[i];
+			int32_t a[4] = { t.adjtet1, t.adjtet2, t.adjtet3, t.adjtet4 };
+			for (int k = 0; k < 4; k++)
+			{
+				if (a[k] < 0 || (uint32_t)a[k] >= tetnum) continue;
+				const tetrahedra &nb = tetmesh.tetrahedras[a[k]];
+				if (nb.adjtet1 != (int32_t)i && nb.adjtet2 != (int32_t)i && nb.adjtet3 != (int32_t)i && nb.adjtet4 != (int32_t)i) { bad++; break; }
+			}
+		}
+	});
+
+	fprintf_s(stderr, "Normalized %u tetrahedra: %u reoriented, %u with faces or neighbours reordered \n", tetnum, (uint32_t)flipped, (uint32_t)moved);
+	if (bad > 0) { std::cout << "Inconsistent faces or neighbours in " << (uint32_t)bad << " tetrahedra"; return false; }
+	return true;
 }
 
-void ConstrainToBBox(BBox* boundingbox, float4 &p)
+/* loads basename.ele/.neigh/.node/.face/.t2f (and .edge if present) concurrently */
+/* all header counts are read and the arrays sized first, so no loader resizes while another one writes */
+bool tetrahedra_mesh::load_mesh(std::string basename)
 {
-	if (boundingbox->min.x + 0.2 < p.x)  p.x = boundingbox->min.x;
-	if (boundingbox->max.x - 0.2 > p.x)  p.x = boundingbox->max.x;
-	if (boundingbox->min.y + 0.2 < p.y)  p.y = boundingbox->min.y;
-	if (boundingbox->max.y - 0.2 > p.y)  p.y = boundingbox->max.y;
-	if (boundingbox->min.z + 0.2 < p.z)  p.z = boundingbox->min.z;
-	if (boundingbox->max.z - 0.2 > p.z)  p.z = boundingbox->max.z;
+	mapped_file t2f;
+	uint32_t neighnum = 0;
+	if (!read_tet_header(basename + ".ele", tetnum)) { std::cout << "Unable to open .ele file"; return false; }
+	if (!read_tet_header(basename + ".neigh", neighnum)) { std::cout << "Unable to open .neigh file"; return false; }
+	if (neighnum != tetnum) { std::cout << "Unable to load mesh, .neigh has " << neighnum << " tetrahedra and .ele " << tetnum; return false; }
+	if (!read_tet_header(basename + ".node", nodenum)) { std::cout << "Unable to open .node file"; return false; }
+	if (!read_tet_header(basename + ".face", facenum)) { std::cout << "Unable to open .face file"; return false; }
+	if (!t2f.open(basename + ".t2f")) { std::cout << "Unable to open .t2f file"; return false; }
+	t2f.close();
+	bool has_edges = read_tet_header(basename + ".edge", edgenum);
+
+	tetrahedras.assign(tetnum, tetrahedra());
+	nodes.assign(nodenum, node());
+	faces.assign(facenum, face());
+	edges.assign(has_edges ? edgenum : 0, edge());
+
+	// .neigh and .t2f fill other members of the same tetrahedra records as .ele
+	std::vector<std::future<void>> jobs;
+	jobs.push_back(std::async(std::launch::async, &tetrahedra_mesh::load_tet_ele, this, basename + ".ele"));
+	jobs.push_back(std::async(std::launch::async, &tetrahedra_mesh::load_tet_neigh, this, basename + ".neigh"));
+	jobs.push_back(std::async(std::launch::async, &tetrahedra_mesh::load_tet_node, this, basename + ".node"));
+	jobs.push_back(std::async(std::launch::async, &tetrahedra_mesh::load_tet_face, this, basename + ".face"));
+	jobs.push_back(std::async(std::launch::async, &tetrahedra_mesh::load_tet_t2f, this, basename + ".t2f"));
+	if (has_edges) jobs.push_back(std::async(std::launch::async, &tetrahedra_mesh::load_tet_edge, this, basename + ".edge"));
+	for (auto &job : jobs) job.get();
+	return normalize_tet_order(*this, threads);
 }
 
-void GetExitTet(float4 ray_o, float4 ray_d, float4* nodes, int32_t findex[4], int32_t adjtet[4], int32_t lface, int32_t &face, int32_t &tet)
+/* renumbers nodes and tetrahedra along a Morton curve (nodes by position, tetrahedra by centroid), so */
+/* neighbours in space are close in memory. Faces are numbered in the order the reordered tetrahedra */
+/* first use them, edges by their lower node. All indices (nindex, adjtet, findex, face and edge nodes) */
+/* are remapped, the mesh stays the same. Call before init_mesh2 / save_mesh_cache */
+void reorder_mesh(tetrahedra_mesh &tetmesh, unsigned threads = 0)
 {
-	face = 0;
-	tet = 0;
-
-	// http://realtimecollisiondetection.net/blog/?p=13
-	// and https://github.com/JKolios/RayTetra/blob/master/RayTetra/RayTetraSTP0.cl
-
-	// translate Ray to origin and vertices same as ray
-	float4 q = ray_d;
+	auto start = std::chrono::steady_clock::now();
+	uint32_t tetnum = (uint32_t)tetmesh.tetrahedras.size(), nodenum = (uint32_t)tetmesh.nodes.size();
+	uint32_t facenum = (uint32_t)tetmesh.faces.size(), edgenum = (uint32_t)tetmesh.edges.size();
+	if (nodenum == 0) return;
 
-	float4 v0 = make_float4(nodes[0].x, nodes[0].y, nodes[0].z, 0); // A
-	float4 v1 = make_float4(nodes[1].x, nodes[1].y, nodes[1].z, 0); // B
-	float4 v2 = make_float4(nodes[2].x, nodes[2].y, nodes[2].z, 0); // C
-	float4 v3 = make_float4(nodes[3].x, nodes[3].y, nodes[3].z, 0); // D
-
-	float4 p0 = v0 - ray_o;
-	float4 p1 = v1 - ray_o;
-	float4 p2 = v2 - ray_o;
-	float4 p3 = v3 - ray_o;
-
-	double QAB = ScTP(q, p0, p1); // A B
-	double QBC = ScTP(q, p1, p2); // B C
-	double QAC = ScTP(q, p0, p2); // A C
-	double QAD = ScTP(q, p0, p3); // A D
-	double QBD = ScTP(q, p1, p3); // B D
-	double QCD = ScTP(q, p2, p3); // C D
-
-	double sQAB = signf(QAB); // A B
-	double sQBC = signf(QBC); // B C
-	double sQAC = signf(QAC); // A C
-	double sQAD = signf(QAD); // A D
-	double sQBD = signf(QBD); // B D
-	double sQCD = signf(QCD); // C D
-
-	// ABC
-	if (sQAB != 0 && sQAC !=0 && sQBC != 0)
+	float4 lo = tetmesh.nodes[0].f_node(), hi = lo;
+	for (const node &nd : tetmesh.nodes)
 	{
-		if (sQAB < 0 && sQAC > 0 && sQBC < 0) { face = findex[3]; tet = adjtet[3]; } // exit face
+		float4 p = nd.f_node();
+		lo.x = std::min(lo.x, p.x); lo.y = std::min(lo.y, p.y); lo.z = std::min(lo.z, p.z);
+		hi.x = std::max(hi.x, p.x); hi.y = std::max(hi.y, p.y); hi.z = std::max(hi.z, p.z);
 	}
-	// BAD
-	if (sQAB != 0 && sQAD != 0 && sQBD != 0)
+	// one scale for all axes, so the curve does not stretch flat meshes
+	float extent = std::max(std::max(hi.x - lo.x, hi.y - lo.y), hi.z - lo.z);
+	float s = (extent > 0) ? 1.0f / extent : 0.0f;
+	float4 scale = make_float4(s, s, s, 0);
+
+	// sorts Morton code (high word) / old index (low word) pairs and returns new index of every old index
+	auto ranks = [&](std::vector<uint64_t> &order)
 	{
-		if (sQAB > 0 && sQAD < 0 && sQBD > 0) { face = findex[2]; tet = adjtet[2]; } // exit face
-	}
-	// CDA
-	if (sQAD != 0 && sQAC != 0 && sQCD != 0)
+		std::sort(order.begin(), order.end());
+		std::vector<int32_t> rank(order.size());
+		for (size_t i = 0; i < order.size(); i++) rank[(uint32_t)order[i]] = (int32_t)i;
+		return rank;
+	};
+	auto remap = [](const std::vector<int32_t> &rank, int32_t i) { return (i >= 0 && (size_t)i < rank.size()) ? rank[i] : i; };
+
+	std::vector<uint64_t> order(nodenum);
+	tet_parallel_for(nodenum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++) order[i] = (uint64_t)MortonCode(tetmesh.nodes[i].f_node(), lo, scale) << 32 | (uint32_t)i;
+	});
+	std::vector<int32_t> new_node = ranks(order);
+
+	order.resize(tetnum);
+	tet_parallel_for(tetnum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const tetrahedra &t = tetmesh.tetrahedras[i];
+			float4 c = make_float4(0, 0, 0, 0);
+			int32_t n[4] = { t.nindex1, t.nindex2, t.nindex3, t.nindex4 };
+			for (int k = 0; k < 4; k++) if (n[k] >= 0 && (uint32_t)n[k] < nodenum) c = c + tetmesh.nodes[n[k]].f_node();
+			order[i] = (uint64_t)MortonCode(c * 0.25f, lo, scale) << 32 | (uint32_t)i;
+		}
+	});
+	std::vector<int32_t> new_tet = ranks(order);
+	std::vector<uint32_t> old_tet(tetnum);
+	for (uint32_t i = 0; i < tetnum; i++) old_tet[new_tet[i]] = i;
+
+	// faces in order of first use, unused faces at the end
+	std::vector<int32_t> new_face(facenum, -1);
+	int32_t nextface = 0;
+	for (uint32_t i = 0; i < tetnum; i++)
+	{
+		const tetrahedra &t = tetmesh.tetrahedras[old_tet[i]];
+		int32_t f[4] = { t.findex1, t.findex2, t.findex3, t.findex4 };
+		for (int k = 0; k < 4; k++) if (f[k] >= 0 && (uint32_t)f[k] < facenum && new_face[f[k]] == -1) new_face[f[k]] = nextface++;
+	}
+	for (uint32_t i = 0; i < facenum; i++) if (new_face[i] == -1) new_face[i] = nextface++;
+
+	tet_array<tetrahedra> tets(tetnum);
+	tet_parallel_for(tetnum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			tetrahedra t = tetmesh.tetrahedras[old_tet[i]];
+			t.number = (uint32_t)i;
+			t.nindex1 = remap(new_node, t.nindex1); t.nindex2 = remap(new_node, t.nindex2); t.nindex3 = remap(new_node, t.nindex3); t.nindex4 = remap(new_node, t.nindex4);
+			t.adjtet1 = remap(new_tet, t.adjtet1); t.adjtet2 = remap(new_tet, t.adjtet2); t.adjtet3 = remap(new_tet, t.adjtet3); t.adjtet4 = remap(new_tet, t.adjtet4);
+			t.findex1 = remap(new_face, t.findex1); t.findex2 = remap(new_face, t.findex2); t.findex3 = remap(new_face, t.findex3); t.findex4 = remap(new_face, t.findex4);
+			tets[i] = t;
+		}
+	});
+	tetmesh.tetrahedras.swap(tets);
+
+	tet_array<node> nodes(nodenum);
+	for (uint32_t i = 0; i < nodenum; i++)
+	{
+		node &nd = nodes[new_node[i]];
+		nd = tetmesh.nodes[i];
+		nd.index = new_node[i];
+	}
+	tetmesh.nodes.swap(nodes);
+
+	tet_array<face> faces(facenum);
+	for (uint32_t i = 0; i < facenum; i++)
+	{
+		face &fc = faces[new_face[i]];
+		fc = tetmesh.faces[i];
+		fc.index = new_face[i];
+		fc.node_a = remap(new_node, fc.node_a); fc.node_b = remap(new_node, fc.node_b); fc.node_c = remap(new_node, fc.node_c);
+	}
+	tetmesh.faces.swap(faces);
+
+	for (edge &ed : tetmesh.edges) { ed.node1 = remap(new_node, ed.node1); ed.node2 = remap(new_node, ed.node2); }
+	std::sort(tetmesh.edges.begin(), tetmesh.edges.end(), [](const edge &a, const edge &b) { return std::min(a.node1, a.node2) < std::min(b.node1, b.node2); });
+	for (uint32_t i = 0; i < edgenum; i++) tetmesh.edges[i].index = i;
+
+	fprintf_s(stderr, "Reordered mesh with %u tetrahedra and %u nodes in %.3f s \n", tetnum, nodenum,
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
+
+//----------------------- binary mesh cache -----------------------------------------------------------------
+
+/* versioned binary image of a tetrahedra_mesh: a header followed by 64-byte aligned SoA arrays */
+/* the file is written in native byte order; a foreign byte order fails the magic check */
+
+#define TET_CACHE_MAGIC 0x48435454u // "TTCH"
+#define TET_CACHE_VERSION 2u
+#define TET_CACHE_ALIGN 64
+
+enum mesh_cache_array
+{
+	cache_n_x, cache_n_y, cache_n_z,
+	cache_t_nindex1, cache_t_nindex2, cache_t_nindex3, cache_t_nindex4,
+	cache_t_adjtet1, cache_t_adjtet2, cache_t_adjtet3, cache_t_adjtet4,
+	cache_t_findex1, cache_t_findex2, cache_t_findex3, cache_t_findex4,
+	cache_f_node_a, cache_f_node_b, cache_f_node_c,
+	cache_face_is_constrained, cache_face_is_wall,
+	cache_n_xd, cache_n_yd, cache_n_zd, // the nodes as read, see init_double_nodes()
+	cache_arrays
+};
+
+struct mesh_cache_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t tetnum, nodenum, facenum, edgenum;
+	uint64_t filesize;
+	uint64_t offset[cache_arrays]; // byte offset of every array from the start of the file
+};
+
+static_assert(sizeof(bool) == 1, "the mesh cache stores face flags as one byte bools");
+
+struct mesh_cache_arrays
+{
+	uint32_t tetnum = 0, nodenum = 0, facenum = 0, edgenum = 0;
+	const float *n_x = nullptr, *n_y = nullptr, *n_z = nullptr;
+	const int32_t *t_nindex1 = nullptr, *t_nindex2 = nullptr, *t_nindex3 = nullptr, *t_nindex4 = nullptr;
+	const int32_t *t_adjtet1 = nullptr, *t_adjtet2 = nullptr, *t_adjtet3 = nullptr, *t_adjtet4 = nullptr;
+	const int32_t *t_findex1 = nullptr, *t_findex2 = nullptr, *t_findex3 = nullptr, *t_findex4 = nullptr;
+	const int32_t *f_node_a = nullptr, *f_node_b = nullptr, *f_node_c = nullptr;
+	const bool *face_is_constrained = nullptr, *face_is_wall = nullptr;
+	const double *n_xd = nullptr, *n_yd = nullptr, *n_zd = nullptr;
+};
+
+/* zero-copy view of a mapped cache file, valid as long as the mesh_cache lives */
+struct mesh_cache : mesh_cache_arrays
+{
+	mapped_file file;
+
+	void close() { file.close(); static_cast<mesh_cache_arrays&>(*this) = mesh_cache_arrays(); }
+};
+
+// element size and count of every cache array
+void mesh_cache_layout(uint32_t tetnum, uint32_t nodenum, uint32_t facenum, size_t elemsize[cache_arrays], size_t count[cache_arrays])
+{
+	for (int a = 0; a < cache_arrays; a++)
+	{
+		if (a <= cache_n_z) { elemsize[a] = sizeof(float); count[a] = nodenum; }
+		else if (a <= cache_t_findex4) { elemsize[a] = sizeof(int32_t); count[a] = tetnum; }
+		else if (a <= cache_f_node_c) { elemsize[a] = sizeof(int32_t); count[a] = facenum; }
+		else if (a <= cache_face_is_wall) { elemsize[a] = sizeof(bool); count[a] = facenum; }
+		else { elemsize[a] = sizeof(double); count[a] = nodenum; }
+	}
+}
+
+// writes one SoA array gathered from the AoS mesh arrays, in blocks to keep the buffer small
+template <typename T, typename C, typename F>
+void write_cache_array(std::ofstream &out, const C &container, F field)
+{
+	std::vector<T> buffer;
+	buffer.reserve(65536);
+	for (size_t i = 0; i < container.size(); i += 65536)
+	{
+		buffer.clear();
+		size_t end = std::min(container.size(), i + 65536);
+		for (size_t j = i; j < end; j++) buffer.push_back((T)field(container[j]));
+		out.write((const char*)buffer.data(), buffer.size() * sizeof(T));
+	}
+}
+
+/* writes the mesh into a binary cache file that open_mesh_cache() can map without parsing */
+bool save_mesh_cache(const tetrahedra_mesh &mesh, std::string filename)
+{
+	mesh_cache_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = TET_CACHE_MAGIC;
+	header.version = TET_CACHE_VERSION;
+	header.tetnum = (uint32_t)mesh.tetrahedras.size();
+	header.nodenum = (uint32_t)mesh.nodes.size();
+	header.facenum = (uint32_t)mesh.faces.size();
+	header.edgenum = (uint32_t)mesh.edges.size();
+
+	size_t elemsize[cache_arrays], count[cache_arrays];
+	mesh_cache_layout(header.tetnum, header.nodenum, header.facenum, elemsize, count);
+	uint64_t offset = sizeof(header);
+	for (int a = 0; a < cache_arrays; a++)
+	{
+		offset = (offset + TET_CACHE_ALIGN - 1) / TET_CACHE_ALIGN * TET_CACHE_ALIGN;
+		header.offset[a] = offset;
+		offset += (uint64_t)elemsize[a] * count[a];
+	}
+	header.filesize = offset;
+
+	std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+	if (!out.is_open()) { std::cout << "Unable to write mesh cache file"; return false; }
+	out.write((const char*)&header, sizeof(header));
+
+	const char zeros[TET_CACHE_ALIGN] = {};
+	for (int a = 0; a < cache_arrays; a++)
+	{
+		out.write(zeros, header.offset[a] - (uint64_t)out.tellp());
+		switch (a)
+		{
+		case cache_n_x: write_cache_array<float>(out, mesh.nodes, [](const node &n) { return n.x; }); break;
+		case cache_n_y: write_cache_array<float>(out, mesh.nodes, [](const node &n) { return n.y; }); break;
+		case cache_n_z: write_cache_array<float>(out, mesh.nodes, [](const node &n) { return n.z; }); break;
+		case cache_t_nindex1: write_cache_array<int32_t>(out, mesh.tetrahedras, [](const tetrahedra &t) { return t.nindex1; }); break;
+		case cache_t_nindex2: write_cache_array<int32_t>(out, mesh.tetrahedras, [](const tetrahedra &t) { return t.nindex2; }); break;
+		case cache_t_nindex3: write_cache_array<int32_t>(out, mesh.tetrahedras, [](const tetrahedra &t) { return t.nindex3; }); break;
+		case cache_t_nindex4: write_cache_array<int32_t>(out, mesh.tetrahedras, [](const tetrahedra &t) { return t.nindex4; }); break;
+		case cache_t_adjtet1: write_cache_array<int32_t>(out, mesh.tetrahedras, [](const tetrahedra &t) { return t.adjtet1; }); break;
+		case cache_t_adjtet2: write_cache_array<int32_t>(out, mesh.tetrahedras, [](const tetrahedra &t) { return t.adjtet2; }); break;
+		case cache_t_adjtet3: write_cache_array<int32_t>(out, mesh.tetrahedras, [](const tetrahedra &t) { return t.adjtet3; }); break;
+		case cache_t_adjtet4: write_cache_array<int32_t>(out, mesh.tetrahedras, [](const tetrahedra &t) { return t.adjtet4; }); break;
+		case cache_t_findex1: write_cache_array<int32_t>(out, mesh.tetrahedras, [](const tetrahedra &t) { return t.findex1; }); break;
+		case cache_t_findex2: write_cache_array<int32_t>(out, mesh.tetrahedras, [](const tetrahedra &t) { return t.findex2; }); break;
+		case cache_t_findex3: write_cache_array<int32_t>(out, mesh.tetrahedras, [](const tetrahedra &t) { return t.findex3; }); break;
+		case cache_t_findex4: write_cache_array<int32_t>(out, mesh.tetrahedras, [](const tetrahedra &t) { return t.findex4; }); break;
+		case cache_f_node_a: write_cache_array<int32_t>(out, mesh.faces, [](const face &f) { return f.node_a; }); break;
+		case cache_f_node_b: write_cache_array<int32_t>(out, mesh.faces, [](const face &f) { return f.node_b; }); break;
+		case cache_f_node_c: write_cache_array<int32_t>(out, mesh.faces, [](const face &f) { return f.node_c; }); break;
+		case cache_face_is_constrained: write_cache_array<uint8_t>(out, mesh.faces, [](const face &f) { return f.face_is_constrained; }); break;
+		case cache_face_is_wall: write_cache_array<uint8_t>(out, mesh.faces, [](const face &f) { return f.face_is_wall; }); break;
+		case cache_n_xd: write_cache_array<double>(out, mesh.nodes, [](const node &n) { return n.x; }); break;
+		case cache_n_yd: write_cache_array<double>(out, mesh.nodes, [](const node &n) { return n.y; }); break;
+		case cache_n_zd: write_cache_array<double>(out, mesh.nodes, [](const node &n) { return n.z; }); break;
+		}
+	}
+	out.close();
+	if (out.fail()) { std::cout << "Unable to write mesh cache file"; return false; }
+	fprintf_s(stderr, "Wrote mesh cache with %u tetrahedra, %u nodes and %u faces \n", header.tetnum, header.nodenum, header.facenum);
+	return true;
+}
+
+/* maps a cache file written by save_mesh_cache(); the arrays point straight into the mapping */
+bool open_mesh_cache(std::string filename, mesh_cache &cache)
+{
+	cache.close();
+	if (!cache.file.open(filename)) { std::cout << "Unable to open mesh cache file"; return false; }
+
+	mesh_cache_header header;
+	if (cache.file.size < sizeof(header)) { std::cout << "Mesh cache file is truncated"; cache.close(); return false; }
+	memcpy(&header, cache.file.data, sizeof(header));
+	if (header.magic != TET_CACHE_MAGIC || header.version != TET_CACHE_VERSION)
+	{
+		std::cout << "Mesh cache file has an unknown format or version";
+		cache.close();
+		return false;
+	}
+
+	size_t elemsize[cache_arrays], count[cache_arrays];
+	mesh_cache_layout(header.tetnum, header.nodenum, header.facenum, elemsize, count);
+	bool valid = header.filesize == cache.file.size;
+	for (int a = 0; a < cache_arrays && valid; a++)
+	{
+		valid = header.offset[a] % TET_CACHE_ALIGN == 0 && header.offset[a] >= sizeof(header)
+			&& header.offset[a] + (uint64_t)elemsize[a] * count[a] <= cache.file.size;
+	}
+	if (!valid) { std::cout << "Mesh cache file is corrupt"; cache.close(); return false; }
+
+	const char* base = cache.file.data;
+	cache.tetnum = header.tetnum;
+	cache.nodenum = header.nodenum;
+	cache.facenum = header.facenum;
+	cache.edgenum = header.edgenum;
+	cache.n_x = (const float*)(base + header.offset[cache_n_x]);
+	cache.n_y = (const float*)(base + header.offset[cache_n_y]);
+	cache.n_z = (const float*)(base + header.offset[cache_n_z]);
+	cache.t_nindex1 = (const int32_t*)(base + header.offset[cache_t_nindex1]);
+	cache.t_nindex2 = (const int32_t*)(base + header.offset[cache_t_nindex2]);
+	cache.t_nindex3 = (const int32_t*)(base + header.offset[cache_t_nindex3]);
+	cache.t_nindex4 = (const int32_t*)(base + header.offset[cache_t_nindex4]);
+	cache.t_adjtet1 = (const int32_t*)(base + header.offset[cache_t_adjtet1]);
+	cache.t_adjtet2 = (const int32_t*)(base + header.offset[cache_t_adjtet2]);
+	cache.t_adjtet3 = (const int32_t*)(base + header.offset[cache_t_adjtet3]);
+	cache.t_adjtet4 = (const int32_t*)(base + header.offset[cache_t_adjtet4]);
+	cache.t_findex1 = (const int32_t*)(base + header.offset[cache_t_findex1]);
+	cache.t_findex2 = (const int32_t*)(base + header.offset[cache_t_findex2]);
+	cache.t_findex3 = (const int32_t*)(base + header.offset[cache_t_findex3]);
+	cache.t_findex4 = (const int32_t*)(base + header.offset[cache_t_findex4]);
+	cache.f_node_a = (const int32_t*)(base + header.offset[cache_f_node_a]);
+	cache.f_node_b = (const int32_t*)(base + header.offset[cache_f_node_b]);
+	cache.f_node_c = (const int32_t*)(base + header.offset[cache_f_node_c]);
+	cache.face_is_constrained = (const bool*)(base + header.offset[cache_face_is_constrained]);
+	cache.face_is_wall = (const bool*)(base + header.offset[cache_face_is_wall]);
+	cache.n_xd = (const double*)(base + header.offset[cache_n_xd]);
+	cache.n_yd = (const double*)(base + header.offset[cache_n_yd]);
+	cache.n_zd = (const double*)(base + header.offset[cache_n_zd]);
+	return true;
+}
+
+//----------------------- SoA mesh -----------------------------------------------------------------
+
+/* one cache line per tetrahedron with everything a traversal step needs besides the node coordinates */
+/* the four local faces are numbered like the nodes, face k lies opposite to node k. adj[k] holds */
+/* (neighbour << 2) | slot of the shared face in the neighbour, -1 on the boundary; bit k of flags */
+/* is set if face k is constrained, bit 4 + k if it is a wall */
+struct alignas(64) tet_record
+{
+	int32_t node[4];
+	int32_t adj[4];
+	int32_t face[4];
+	uint32_t flags;
+	uint32_t unused[3];
+};
+static_assert(sizeof(tet_record) == 64, "tet_record has to fill one cache line");
+
+/* storage of the optional per-tetrahedron vertex cache, see init_tet_vertices() */
+enum tet_vertex_mode
+{
+	tet_vertices_float, // the four nodes as 12 floats, 48 bytes per tet, exact copies
+	tet_vertices_compact // the nodes on a 16 bit lattice relative to node 0, 32 bytes per tet
+};
+
+/* compact vertices of a tetrahedron: lattice point of node 0 and the offsets of nodes 1..3 */
+struct tet_vertex_compact
+{
+	int32_t origin[3];
+	int16_t delta[3][3];
+	int16_t unused;
+};
+static_assert(sizeof(tet_vertex_compact) == 32, "two compact vertex records per cache line");
+
+
+/* structure-of-arrays mesh used by point location and traversal */
+/* every array starts on a 64-byte boundary of one block owned by the mesh, */
+/* or points into a mapped mesh_cache, in which case the arrays are read-only */
+struct mesh2
+{
+	uint32_t tetnum = 0, nodenum = 0, facenum = 0, edgenum = 0;
+	float *n_x = nullptr, *n_y = nullptr, *n_z = nullptr;
+	int32_t *t_nindex1 = nullptr, *t_nindex2 = nullptr, *t_nindex3 = nullptr, *t_nindex4 = nullptr;
+	int32_t *t_adjtet1 = nullptr, *t_adjtet2 = nullptr, *t_adjtet3 = nullptr, *t_adjtet4 = nullptr;
+	int32_t *t_findex1 = nullptr, *t_findex2 = nullptr, *t_findex3 = nullptr, *t_findex4 = nullptr;
+	int32_t *f_node_a = nullptr, *f_node_b = nullptr, *f_node_c = nullptr;
+	bool *face_is_constrained = nullptr, *face_is_wall = nullptr;
+	char* block = nullptr; // owned storage, nullptr for a cache view
+
+	// optional traversal tables, always owned by the mesh
+	float *e_plucker = nullptr; // see init_edge_plucker()
+	int32_t *t_edges = nullptr;
+
+	// optional point location grid, see init_locate_grid()
+	int32_t *g_seed = nullptr; // one tetrahedron per cell, x fastest
+	int32_t g_res[3] = { 0, 0, 0 };
+	float g_min[3] = { 0, 0, 0 }, g_scale[3] = { 0, 0, 0 }; // lower corner, cells per unit length
+
+	float *t_bary = nullptr; // see init_tet_bary()
+	tet_record *t_packed = nullptr; // see init_tet_records()
+
+	// optional vertex cache, see init_tet_vertices(), at most one of both is set
+	float *t_verts = nullptr;
+	tet_vertex_compact *t_cverts = nullptr;
+	float v_cell = 0; // lattice step of the compact vertices, a power of two
+
+	double *n_xd = nullptr, *n_yd = nullptr, *n_zd = nullptr; // see init_double_nodes()
+	double *n_dblock = nullptr; // owned storage of the double nodes, nullptr for a cache view
+
+	mesh2() {}
+	mesh2(const mesh2&) = delete;
+	mesh2& operator=(const mesh2&) = delete;
+	~mesh2() { release(); }
+
+	bool allocate(uint32_t tets, uint32_t nds, uint32_t fcs);
+	void release();
+};
+
+bool mesh2::allocate(uint32_t tets, uint32_t nds, uint32_t fcs)
+{
+	release();
+	auto aligned = [](size_t bytes) { return (bytes + 63) / 64 * 64; };
+	size_t nbytes = aligned(sizeof(float) * nds), tbytes = aligned(sizeof(int32_t) * tets);
+	size_t fbytes = aligned(sizeof(int32_t) * fcs), bbytes = aligned(sizeof(bool) * fcs);
+	size_t total = 3 * nbytes + 12 * tbytes + 3 * fbytes + 2 * bbytes;
+	block = (char*)tet_aligned_alloc(total > 0 ? total : 64);
+	if (block == nullptr) { std::cout << "Unable to allocate mesh2 arrays"; return false; }
+
+	char* p = block;
+	float** farrays[] = { &n_x, &n_y, &n_z };
+	for (float** a : farrays) { *a = (float*)p; p += nbytes; }
+	int32_t** tarrays[] = { &t_nindex1, &t_nindex2, &t_nindex3, &t_nindex4, &t_adjtet1, &t_adjtet2, &t_adjtet3, &t_adjtet4,
+		&t_findex1, &t_findex2, &t_findex3, &t_findex4 };
+	for (int32_t** a : tarrays) { *a = (int32_t*)p; p += tbytes; }
+	int32_t** farrays2[] = { &f_node_a, &f_node_b, &f_node_c };
+	for (int32_t** a : farrays2) { *a = (int32_t*)p; p += fbytes; }
+	face_is_constrained = (bool*)p; p += bbytes;
+	face_is_wall = (bool*)p;
+
+	tetnum = tets;
+	nodenum = nds;
+	facenum = fcs;
+	return true;
+}
+
+void mesh2::release()
+{
+	tet_aligned_free(block);
+	tet_aligned_free(e_plucker);
+	tet_aligned_free(t_edges);
+	tet_aligned_free(g_seed);
+	tet_aligned_free(t_bary);
+	tet_aligned_free(t_packed);
+	tet_aligned_free(t_verts);
+	tet_aligned_free(t_cverts);
+	tet_aligned_free(n_dblock);
+	block = nullptr;
+	e_plucker = nullptr;
+	t_edges = nullptr;
+	g_seed = nullptr;
+	t_bary = nullptr;
+	t_packed = nullptr;
+	t_verts = nullptr;
+	t_cverts = nullptr;
+	n_xd = n_yd = n_zd = n_dblock = nullptr;
+	g_res[0] = g_res[1] = g_res[2] = 0;
+	n_x = n_y = n_z = nullptr;
+	t_nindex1 = t_nindex2 = t_nindex3 = t_nindex4 = nullptr;
+	t_adjtet1 = t_adjtet2 = t_adjtet3 = t_adjtet4 = nullptr;
+	t_findex1 = t_findex2 = t_findex3 = t_findex4 = nullptr;
+	f_node_a = f_node_b = f_node_c = nullptr;
+	face_is_constrained = face_is_wall = nullptr;
+	tetnum = nodenum = facenum = edgenum = 0;
+}
+
+void GetTetNodes(mesh2 *mesh, int32_t tet, float4 nodes[4])
+{
+	int32_t n[4] = { mesh->t_nindex1[tet], mesh->t_nindex2[tet], mesh->t_nindex3[tet], mesh->t_nindex4[tet] };
+	for (int i = 0; i < 4; i++) nodes[i] = make_float4(mesh->n_x[n[i]], mesh->n_y[n[i]], mesh->n_z[n[i]], 0);
+}
+
+/* fills the SoA mesh from the loaded tetgen mesh, on up to 'threads' threads (0 = all cores) */
+bool init_mesh2(mesh2 *mesh, const tetrahedra_mesh &tetmesh, unsigned threads = 0)
+{
+	if (!mesh->allocate((uint32_t)tetmesh.tetrahedras.size(), (uint32_t)tetmesh.nodes.size(), (uint32_t)tetmesh.faces.size())) return false;
+	mesh->edgenum = (uint32_t)tetmesh.edges.size();
+
+	tet_parallel_for(mesh->nodenum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const node &nd = tetmesh.nodes[i];
+			mesh->n_x[i] = (float)nd.x;
+			mesh->n_y[i] = (float)nd.y;
+			mesh->n_z[i] = (float)nd.z;
+		}
+	});
+	tet_parallel_for(mesh->tetnum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const tetrahedra &tet = tetmesh.tetrahedras[i];
+			mesh->t_nindex1[i] = tet.nindex1;
+			mesh->t_nindex2[i] = tet.nindex2;
+			mesh->t_nindex3[i] = tet.nindex3;
+			mesh->t_nindex4[i] = tet.nindex4;
+			mesh->t_adjtet1[i] = tet.adjtet1;
+			mesh->t_adjtet2[i] = tet.adjtet2;
+			mesh->t_adjtet3[i] = tet.adjtet3;
+			mesh->t_adjtet4[i] = tet.adjtet4;
+			mesh->t_findex1[i] = tet.findex1;
+			mesh->t_findex2[i] = tet.findex2;
+			mesh->t_findex3[i] = tet.findex3;
+			mesh->t_findex4[i] = tet.findex4;
+		}
+	});
+	tet_parallel_for(mesh->facenum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const face &fc = tetmesh.faces[i];
+			mesh->f_node_a[i] = fc.node_a;
+			mesh->f_node_b[i] = fc.node_b;
+			mesh->f_node_c[i] = fc.node_c;
+			mesh->face_is_constrained[i] = fc.face_is_constrained;
+			mesh->face_is_wall[i] = fc.face_is_wall;
+		}
+	});
+	return true;
+}
+
+/* points the SoA mesh at the arrays of an open mesh cache, nothing is copied */
+/* the arrays stay read-only and valid only as long as the cache is open */
+bool init_mesh2(mesh2 *mesh, const mesh_cache &cache)
+{
+	mesh->release();
+	if (cache.file.data == nullptr) return false;
+	mesh->tetnum = cache.tetnum;
+	mesh->nodenum = cache.nodenum;
+	mesh->facenum = cache.facenum;
+	mesh->edgenum = cache.edgenum;
+	mesh->n_x = const_cast<float*>(cache.n_x);
+	mesh->n_y = const_cast<float*>(cache.n_y);
+	mesh->n_z = const_cast<float*>(cache.n_z);
+	mesh->t_nindex1 = const_cast<int32_t*>(cache.t_nindex1);
+	mesh->t_nindex2 = const_cast<int32_t*>(cache.t_nindex2);
+	mesh->t_nindex3 = const_cast<int32_t*>(cache.t_nindex3);
+	mesh->t_nindex4 = const_cast<int32_t*>(cache.t_nindex4);
+	mesh->t_adjtet1 = const_cast<int32_t*>(cache.t_adjtet1);
+	mesh->t_adjtet2 = const_cast<int32_t*>(cache.t_adjtet2);
+	mesh->t_adjtet3 = const_cast<int32_t*>(cache.t_adjtet3);
+	mesh->t_adjtet4 = const_cast<int32_t*>(cache.t_adjtet4);
+	mesh->t_findex1 = const_cast<int32_t*>(cache.t_findex1);
+	mesh->t_findex2 = const_cast<int32_t*>(cache.t_findex2);
+	mesh->t_findex3 = const_cast<int32_t*>(cache.t_findex3);
+	mesh->t_findex4 = const_cast<int32_t*>(cache.t_findex4);
+	mesh->f_node_a = const_cast<int32_t*>(cache.f_node_a);
+	mesh->f_node_b = const_cast<int32_t*>(cache.f_node_b);
+	mesh->f_node_c = const_cast<int32_t*>(cache.f_node_c);
+	mesh->face_is_constrained = const_cast<bool*>(cache.face_is_constrained);
+	mesh->face_is_wall = const_cast<bool*>(cache.face_is_wall);
+	return true;
+}
+
+/* optional double precision copy of the node coordinates (24 bytes per node) for the exit and point */
+/* tests with double rays (traverse_ray with tet_vec3 rays); everything else keeps using the float nodes */
+bool init_double_nodes(mesh2 *mesh, const tetrahedra_mesh &tetmesh, unsigned threads = 0)
+{
+	tet_aligned_free(mesh->n_dblock);
+	mesh->n_xd = mesh->n_yd = mesh->n_zd = mesh->n_dblock = nullptr;
+	if (tetmesh.nodes.size() != mesh->nodenum) { std::cout << "Unable to build double nodes, the mesh does not match"; return false; }
+	size_t stride = ((size_t)mesh->nodenum * sizeof(double) + 63) / 64 * 64 / sizeof(double);
+	mesh->n_dblock = (double*)tet_aligned_alloc(3 * stride * sizeof(double) + 64);
+	if (mesh->n_dblock == nullptr) { std::cout << "Unable to allocate double nodes"; return false; }
+	mesh->n_xd = mesh->n_dblock;
+	mesh->n_yd = mesh->n_xd + stride;
+	mesh->n_zd = mesh->n_yd + stride;
+	tet_parallel_for(mesh->nodenum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const node &nd = tetmesh.nodes[i];
+			mesh->n_xd[i] = nd.x;
+			mesh->n_yd[i] = nd.y;
+			mesh->n_zd[i] = nd.z;
+		}
+	});
+	return true;
+}
+
+/* the double nodes of a mesh opened from a cache, nothing is copied; valid as long as the cache is open */
+bool init_double_nodes(mesh2 *mesh, const mesh_cache &cache)
+{
+	tet_aligned_free(mesh->n_dblock);
+	mesh->n_xd = mesh->n_yd = mesh->n_zd = mesh->n_dblock = nullptr;
+	if (cache.n_xd == nullptr || cache.nodenum != mesh->nodenum) { std::cout << "Unable to build double nodes, the mesh does not match"; return false; }
+	mesh->n_xd = const_cast<double*>(cache.n_xd);
+	mesh->n_yd = const_cast<double*>(cache.n_yd);
+	mesh->n_zd = const_cast<double*>(cache.n_zd);
+	return true;
+}
+
+/* optional table for GetExitTet: Plücker coordinates of every mesh edge and the six edges of every */
+/* tetrahedron, so a traversal step tests the ray against six precomputed lines instead of the nodes */
+/* e_plucker holds 8 floats per edge node1->node2: direction node2 - node1, moment node1 x node2, the */
+/* largest absolute coordinate of both nodes (for the error bound of the side test) and 1 unused */
+/* t_edges holds per tet the edges AB BC AC AD BD CD as (edge << 1) | 1 if the edge runs against the tet's order */
+/* memory: 32 bytes per edge + 24 bytes per tet. Requires the .edge file. Coordinates enter the moment */
+/* unshifted, so meshes far from the origin lose more digits than the node based test */
+bool init_edge_plucker(mesh2 *mesh, const tetrahedra_mesh &tetmesh, unsigned threads = 0)
+{
+	static const int32_t edgevertex[6][2] = { { 0, 1 }, { 1, 2 }, { 0, 2 }, { 0, 3 }, { 1, 3 }, { 2, 3 } };
+	size_t edgenum = tetmesh.edges.size();
+	if (edgenum == 0) { std::cout << "No .edge file loaded, cannot build Plücker table"; return false; }
+
+	auto drop = [mesh]()
+	{
+		tet_aligned_free(mesh->e_plucker);
+		tet_aligned_free(mesh->t_edges);
+		mesh->e_plucker = nullptr;
+		mesh->t_edges = nullptr;
+	};
+	drop();
+	mesh->e_plucker = (float*)tet_aligned_alloc(8 * sizeof(float) * edgenum);
+	mesh->t_edges = (int32_t*)tet_aligned_alloc(6 * sizeof(int32_t) * (size_t)mesh->tetnum);
+	if (mesh->e_plucker == nullptr || mesh->t_edges == nullptr) { std::cout << "Unable to allocate Plücker table"; drop(); return false; }
+
+	std::vector<uint64_t> keys(edgenum); // node pair of every edge, lower node in the high word
+	std::vector<uint32_t> order(edgenum);
+	auto key = [](uint32_t a, uint32_t b) { return (a < b) ? ((uint64_t)a << 32 | b) : ((uint64_t)b << 32 | a); };
+	tet_parallel_for(edgenum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			const edge &ed = tetmesh.edges[i];
+			float4 a = make_float4(mesh->n_x[ed.node1], mesh->n_y[ed.node1], mesh->n_z[ed.node1], 0);
+			float4 b = make_float4(mesh->n_x[ed.node2], mesh->n_y[ed.node2], mesh->n_z[ed.node2], 0);
+			float4 d = b - a;
+			float4 m = Cross(a, b);
+			float* L = mesh->e_plucker + 8 * i;
+			L[0] = d.x; L[1] = d.y; L[2] = d.z;
+			L[3] = m.x; L[4] = m.y; L[5] = m.z;
+			L[6] = std::max(MaxAbs(a), MaxAbs(b));
+			L[7] = 0;
+			keys[i] = key(ed.node1, ed.node2);
+			order[i] = (uint32_t)i;
+		}
+	});
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+	std::vector<uint64_t> sorted(edgenum);
+	for (size_t i = 0; i < edgenum; i++) sorted[i] = keys[order[i]];
+
+	std::atomic<uint32_t> missing(0);
+	tet_parallel_for(mesh->tetnum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t t = begin; t < end; t++)
+		{
+			int32_t n[4] = { mesh->t_nindex1[t], mesh->t_nindex2[t], mesh->t_nindex3[t], mesh->t_nindex4[t] };
+			for (int e = 0; e < 6; e++)
+			{
+				uint32_t a = n[edgevertex[e][0]], b = n[edgevertex[e][1]];
+				auto it = std::lower_bound(sorted.begin(), sorted.end(), key(a, b));
+				if (it == sorted.end() || *it != key(a, b)) { missing++; mesh->t_edges[6 * t + e] = 0; continue; }
+				uint32_t index = order[it - sorted.begin()];
+				mesh->t_edges[6 * t + e] = (int32_t)(index << 1 | ((uint32_t)tetmesh.edges[index].node1 != a));
+			}
+		}
+	});
+	if (missing > 0) { std::cout << "Tetrahedra edges missing in .edge file, Plücker table not used"; drop(); return false; }
+	return true;
+}
+
+/* optional packed 64-byte records for traversal, see tet_record */
+bool init_tet_records(mesh2 *mesh, unsigned threads = 0)
+{
+	tet_aligned_free(mesh->t_packed);
+	mesh->t_packed = nullptr;
+	if (mesh->tetnum >= (1u << 29)) { std::cout << "Too many tetrahedra for packed records"; return false; }
+	mesh->t_packed = (tet_record*)tet_aligned_alloc(sizeof(tet_record) * (size_t)mesh->tetnum);
+	if (mesh->t_packed == nullptr) { std::cout << "Unable to allocate packed records"; return false; }
+
+	std::atomic<uint32_t> unmatched(0);
+	tet_parallel_for(mesh->tetnum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t t = begin; t < end; t++)
+		{
+			tet_record &r = mesh->t_packed[t];
+			int32_t n[4] = { mesh->t_nindex1[t], mesh->t_nindex2[t], mesh->t_nindex3[t], mesh->t_nindex4[t] };
+			int32_t f[4] = { mesh->t_findex1[t], mesh->t_findex2[t], mesh->t_findex3[t], mesh->t_findex4[t] };
+			int32_t a[4] = { mesh->t_adjtet1[t], mesh->t_adjtet2[t], mesh->t_adjtet3[t], mesh->t_adjtet4[t] };
+			r.flags = 0;
+			r.unused[0] = r.unused[1] = r.unused[2] = 0;
+			for (int k = 0; k < 4; k++)
+			{
+				r.node[k] = n[k];
+				r.face[k] = f[k];
+				if (f[k] >= 0 && (uint32_t)f[k] < mesh->facenum)
+				{
+					if (mesh->face_is_constrained[f[k]]) r.flags |= 1u << k;
+					if (mesh->face_is_wall[f[k]]) r.flags |= 1u << (4 + k);
+				}
+				r.adj[k] = -1;
+				if (a[k] < 0 || (uint32_t)a[k] >= mesh->tetnum) continue;
+
+				// slot of the shared face in the neighbour, by face index or else by the back link
+				int32_t nf[4] = { mesh->t_findex1[a[k]], mesh->t_findex2[a[k]], mesh->t_findex3[a[k]], mesh->t_findex4[a[k]] };
+				int32_t na[4] = { mesh->t_adjtet1[a[k]], mesh->t_adjtet2[a[k]], mesh->t_adjtet3[a[k]], mesh->t_adjtet4[a[k]] };
+				int slot = -1;
+				for (int j = 0; j < 4 && slot < 0; j++) if (nf[j] == f[k]) slot = j;
+				for (int j = 0; j < 4 && slot < 0; j++) if (na[j] == (int32_t)t) slot = j;
+				if (slot < 0) { unmatched++; continue; }
+				r.adj[k] = a[k] << 2 | slot;
+			}
+		}
+	});
+	if (unmatched > 0) { std::cout << "Neighbours without shared face, packed records not used"; tet_aligned_free(mesh->t_packed); mesh->t_packed = nullptr; return false; }
+	return true;
+}
+
+/* optional per-tet copy of the node positions for the node based exit test: 48 bytes per tet, or 32 */
+/* with tet_vertices_compact (16 bit offsets on a lattice, the geometry moves slightly), see README */
+bool init_tet_vertices(mesh2 *mesh, tet_vertex_mode mode = tet_vertices_float, unsigned threads = 0)
+{
+	tet_aligned_free(mesh->t_verts);
+	tet_aligned_free(mesh->t_cverts);
+	mesh->t_verts = nullptr;
+	mesh->t_cverts = nullptr;
+	if (mesh->tetnum == 0 || mesh->nodenum == 0) return false;
+
+	if (mode == tet_vertices_float)
+	{
+		mesh->t_verts = (float*)tet_aligned_alloc(12 * sizeof(float) * (size_t)mesh->tetnum);
+		if (mesh->t_verts == nullptr) { std::cout << "Unable to allocate vertex cache"; return false; }
+		tet_parallel_for(mesh->tetnum, threads, [&](size_t begin, size_t end)
+		{
+			for (size_t t = begin; t < end; t++)
+			{
+				float4 nodes[4];
+				GetTetNodes(mesh, (int32_t)t, nodes);
+				float* v = mesh->t_verts + 12 * t;
+				for (int k = 0; k < 4; k++) { v[3 * k] = nodes[k].x; v[3 * k + 1] = nodes[k].y; v[3 * k + 2] = nodes[k].z; }
+			}
+		});
+		return true;
+	}
+
+	// lattice step from the largest extent of a tetrahedron, but coordinates below 2^24 steps, so
+	// lattice points are exact floats: integer times a power of two
+	float amax = 0;
+	for (uint32_t i = 0; i < mesh->nodenum; i++) amax = std::max(amax, MaxAbs(make_float4(mesh->n_x[i], mesh->n_y[i], mesh->n_z[i], 0)));
+	std::atomic<uint32_t> bits(0); // largest tetrahedron extent as float bits, which order like the values
+	tet_parallel_for(mesh->tetnum, threads, [&](size_t begin, size_t end)
+	{
+		float ext = 0;
+		for (size_t t = begin; t < end; t++)
+		{
+			float4 nodes[4];
+			GetTetNodes(mesh, (int32_t)t, nodes);
+			for (int k = 1; k < 4; k++) ext = std::max(ext, MaxAbs(nodes[k] - nodes[0]));
+		}
+		uint32_t b, old = bits;
+		memcpy(&b, &ext, sizeof(b));
+		while (b > old && !bits.compare_exchange_weak(old, b)) {}
+	});
+	float maxext;
+	uint32_t b = bits;
+	memcpy(&maxext, &b, sizeof(b));
+	double step = std::max((double)maxext / 32766.0, (double)amax / 16777215.0);
+	if (!(step > 0) || !std::isfinite(step)) { std::cout << "Unable to build compact vertex cache"; return false; }
+	float cell = (float)std::exp2(std::ceil(std::log2(step)));
+
+	mesh->t_cverts = (tet_vertex_compact*)tet_aligned_alloc(sizeof(tet_vertex_compact) * (size_t)mesh->tetnum);
+	if (mesh->t_cverts == nullptr) { std::cout << "Unable to allocate vertex cache"; return false; }
+	mesh->v_cell = cell;
+	tet_parallel_for(mesh->tetnum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t t = begin; t < end; t++)
+		{
+			float4 nodes[4];
+			GetTetNodes(mesh, (int32_t)t, nodes);
+			int32_t l[4][3];
+			for (int k = 0; k < 4; k++)
+			{
+				float c[3] = { nodes[k].x, nodes[k].y, nodes[k].z };
+				for (int a = 0; a < 3; a++) l[k][a] = (int32_t)std::lround(c[a] / cell);
+			}
+			tet_vertex_compact &v = mesh->t_cverts[t];
+			for (int a = 0; a < 3; a++) v.origin[a] = l[0][a];
+			for (int k = 1; k < 4; k++) for (int a = 0; a < 3; a++) v.delta[k - 1][a] = (int16_t)(l[k][a] - l[0][a]);
+			v.unused = 0;
+		}
+	});
+	return true;
+}
+
+/* optional grid of start tetrahedra for GetTetrahedraFromPoint without hint */
+/* max_bytes limits its size, 0 = one cell per 4 tetrahedra */
+bool init_locate_grid(mesh2 *mesh, size_t max_bytes = 0, unsigned threads = 0)
+{
+	auto start = std::chrono::steady_clock::now();
+	tet_aligned_free(mesh->g_seed);
+	mesh->g_seed = nullptr;
+	mesh->g_res[0] = mesh->g_res[1] = mesh->g_res[2] = 0;
+	if (mesh->tetnum == 0 || mesh->nodenum == 0) return false;
+
+	float lo[3] = { mesh->n_x[0], mesh->n_y[0], mesh->n_z[0] }, hi[3] = { lo[0], lo[1], lo[2] };
+	for (uint32_t i = 1; i < mesh->nodenum; i++)
+	{
+		float v[3] = { mesh->n_x[i], mesh->n_y[i], mesh->n_z[i] };
+		for (int k = 0; k < 3; k++) { lo[k] = std::min(lo[k], v[k]); hi[k] = std::max(hi[k], v[k]); }
+	}
+
+	// cubic cells, the number of cells close to the budget
+	double cells = (max_bytes > 0) ? (double)(max_bytes / sizeof(int32_t)) : std::max(1.0, mesh->tetnum / 4.0);
+	double ext[3], longest = 0;
+	for (int k = 0; k < 3; k++) { ext[k] = (double)hi[k] - lo[k]; longest = std::max(longest, ext[k]); }
+	if (cells < 1 || longest <= 0) { std::cout << "Unable to build locate grid"; return false; }
+	double h = longest / std::cbrt(cells);
+	for (int i = 0; i < 40; i++)
+	{
+		double n = 1;
+		for (int k = 0; k < 3; k++) n *= std::max(1.0, std::ceil(ext[k] / h));
+		if (n <= cells) break;
+		h *= 1.05;
+	}
+	size_t total = 1;
+	for (int k = 0; k < 3; k++)
+	{
+		mesh->g_res[k] = (int32_t)std::max(1.0, std::ceil(ext[k] / h));
+		mesh->g_min[k] = lo[k];
+		mesh->g_scale[k] = (ext[k] > 0) ? (float)(mesh->g_res[k] / ext[k]) : 0.0f;
+		total *= mesh->g_res[k];
+	}
+	mesh->g_seed = (int32_t*)tet_aligned_alloc(sizeof(int32_t) * total);
+	if (mesh->g_seed == nullptr) { std::cout << "Unable to allocate locate grid"; mesh->g_res[0] = mesh->g_res[1] = mesh->g_res[2] = 0; return false; }
+
+	// cell of every centroid in parallel, then scattered in tetrahedron order
+	std::vector<uint32_t> cell(mesh->tetnum);
+	tet_parallel_for(mesh->tetnum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t t = begin; t < end; t++)
+		{
+			int32_t n[4] = { mesh->t_nindex1[t], mesh->t_nindex2[t], mesh->t_nindex3[t], mesh->t_nindex4[t] };
+			float c[3] = { 0.25f * (mesh->n_x[n[0]] + mesh->n_x[n[1]] + mesh->n_x[n[2]] + mesh->n_x[n[3]]),
+				0.25f * (mesh->n_y[n[0]] + mesh->n_y[n[1]] + mesh->n_y[n[2]] + mesh->n_y[n[3]]),
+				0.25f * (mesh->n_z[n[0]] + mesh->n_z[n[1]] + mesh->n_z[n[2]] + mesh->n_z[n[3]]) };
+			uint32_t idx[3];
+			for (int k = 0; k < 3; k++) idx[k] = (uint32_t)std::min(std::max((int32_t)((c[k] - mesh->g_min[k]) * mesh->g_scale[k]), 0), mesh->g_res[k] - 1);
+			cell[t] = idx[0] + mesh->g_res[0] * (idx[1] + mesh->g_res[1] * idx[2]);
+		}
+	});
+	std::fill(mesh->g_seed, mesh->g_seed + total, -1);
+	for (uint32_t t = 0; t < mesh->tetnum; t++) mesh->g_seed[cell[t]] = (int32_t)t;
+
+	int32_t last = -1;
+	for (size_t i = 0; i < total; i++) { if (mesh->g_seed[i] == -1) mesh->g_seed[i] = last; else last = mesh->g_seed[i]; }
+	for (size_t i = total; i-- > 0;) { if (mesh->g_seed[i] == -1) mesh->g_seed[i] = last; else last = mesh->g_seed[i]; }
+
+	fprintf_s(stderr, "Built locate grid %d x %d x %d (%.1f MB) in %.3f s \n", mesh->g_res[0], mesh->g_res[1], mesh->g_res[2],
+		sizeof(int32_t) * total / 1e6, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	return true;
+}
+
+/* optional table of the barycentric maps (12 floats per tet, row k gives the weight of node k + 2), */
+/* used by the point in tetrahedron tests once built */
+bool init_tet_bary(mesh2 *mesh, unsigned threads = 0)
+{
+	tet_aligned_free(mesh->t_bary);
+	mesh->t_bary = (float*)tet_aligned_alloc(12 * sizeof(float) * (size_t)mesh->tetnum);
+	if (mesh->t_bary == nullptr) { std::cout << "Unable to allocate barycentric table"; return false; }
+
+	tet_parallel_for(mesh->tetnum, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t t = begin; t < end; t++)
+		{
+			int32_t n[4] = { mesh->t_nindex1[t], mesh->t_nindex2[t], mesh->t_nindex3[t], mesh->t_nindex4[t] };
+			double v[4][3];
+			for (int i = 0; i < 4; i++) { v[i][0] = mesh->n_x[n[i]]; v[i][1] = mesh->n_y[n[i]]; v[i][2] = mesh->n_z[n[i]]; }
+			double e[3][3]; // columns B - A, C - A, D - A
+			for (int i = 0; i < 3; i++) for (int k = 0; k < 3; k++) e[i][k] = v[i + 1][k] - v[0][k];
+
+			// rows of the inverse are the cross products of the other two columns over the determinant
+			double r[3][3];
+			for (int i = 0; i < 3; i++)
+			{
+				const double *a = e[(i + 1) % 3], *b = e[(i + 2) % 3];
+				r[i][0] = a[1] * b[2] - a[2] * b[1];
+				r[i][1] = a[2] * b[0] - a[0] * b[2];
+				r[i][2] = a[0] * b[1] - a[1] * b[0];
+			}
+			double det = e[0][0] * r[0][0] + e[0][1] * r[0][1] + e[0][2] * r[0][2];
+			float* M = mesh->t_bary + 12 * t;
+			for (int i = 0; i < 3; i++)
+			{
+				if (det == 0) { M[4 * i] = M[4 * i + 1] = M[4 * i + 2] = 0; M[4 * i + 3] = -1; continue; } // flat tet contains nothing
+				double m[3] = { r[i][0] / det, r[i][1] / det, r[i][2] / det };
+				M[4 * i] = (float)m[0]; M[4 * i + 1] = (float)m[1]; M[4 * i + 2] = (float)m[2];
+				M[4 * i + 3] = (float)-(m[0] * v[0][0] + m[1] * v[0][1] + m[2] * v[0][2]);
+			}
+		}
+	});
+	return true;
+}
+
+/* barycentric coordinates l[0..3] of p for the nodes of tet, needs init_tet_bary() */
+void GetBarycentric(mesh2 *mesh, int32_t tet, float4 p, float l[4])
+{
+	const float* M = mesh->t_bary + 12 * (size_t)tet;
+	l[1] = M[0] * p.x + M[1] * p.y + M[2] * p.z + M[3];
+	l[2] = M[4] * p.x + M[5] * p.y + M[6] * p.z + M[7];
+	l[3] = M[8] * p.x + M[9] * p.y + M[10] * p.z + M[11];
+	l[0] = 1.0f - l[1] - l[2] - l[3];
+}
+
+/* tolerance of the barycentric point in tetrahedron test, points this close to a face count as inside */
+#ifndef TET_BARY_EPS
+#define TET_BARY_EPS 1e-6f
+#endif
+
+bool IsPointInTetBary(mesh2 *mesh, int32_t tet, float4 p)
+{
+	float l[4];
+	GetBarycentric(mesh, tet, p, l);
+	return std::min(std::min(l[0], l[1]), std::min(l[2], l[3])) >= -TET_BARY_EPS;
+}
+
+/* seed tetrahedron of the grid cell containing p (clamped to the grid), -1 without grid */
+int32_t GridSeedTet(mesh2 *mesh, float4 p)
+{
+	if (mesh->g_seed == nullptr) return -1;
+	float v[3] = { p.x, p.y, p.z };
+	int32_t idx[3];
+	for (int k = 0; k < 3; k++)
+	{
+		float f = (v[k] - mesh->g_min[k]) * mesh->g_scale[k];
+		idx[k] = (f <= 0) ? 0 : (f >= (float)mesh->g_res[k]) ? mesh->g_res[k] - 1 : (int32_t)f;
+	}
+	return mesh->g_seed[idx[0] + (size_t)mesh->g_res[0] * (idx[1] + (size_t)mesh->g_res[1] * idx[2])];
+}
+
+//--------------------------------------------------------------------------------------------------------------------------------------
+
+
+bool IsPointInTetrahedron(float4 v1, float4 v2, float4 v3, float4 v4, float4 p)
+{
+		// https://stackoverflow.com/questions/25179693/how-to-check-whether-the-point-is-in-the-tetrahedron-or-not/25180158#25180158
+		return SameSide(v1, v2, v3, v4, p) &&
+		SameSide(v2, v3, v4, v1, p) &&
+		SameSide(v3, v4, v1, v2, p) &&
+		SameSide(v4, v1, v2, v3, p);
+}
+
+template <typename T>
+bool SameSide(const tet_vec3<T> &v1, const tet_vec3<T> &v2, const tet_vec3<T> &v3, const tet_vec3<T> &v4, const tet_vec3<T> &p)
+{
+	tet_vec3<T> normal = Cross(v2 - v1, v3 - v1);
+	return SignOf(Dot(normal, v4 - v1)) == SignOf(Dot(normal, p - v1));
+}
+
+template <typename T>
+bool IsPointInTetrahedron(const tet_vec3<T> &v1, const tet_vec3<T> &v2, const tet_vec3<T> &v3, const tet_vec3<T> &v4, const tet_vec3<T> &p)
+{
+	return SameSide(v1, v2, v3, v4, p) && SameSide(v2, v3, v4, v1, p) && SameSide(v3, v4, v1, v2, p) && SameSide(v4, v1, v2, v3, p);
+}
+
+bool IsPointInThisTet(mesh2* mesh, float4 v, int32_t tet)
+{
+	if (mesh->t_bary != nullptr) return IsPointInTetBary(mesh, tet, v);
+	float4 nodes[4] = {
+		make_float4(mesh->n_x[mesh->t_nindex1[tet]], mesh->n_y[mesh->t_nindex1[tet]], mesh->n_z[mesh->t_nindex1[tet]], 0),
+		make_float4(mesh->n_x[mesh->t_nindex2[tet]], mesh->n_y[mesh->t_nindex2[tet]], mesh->n_z[mesh->t_nindex2[tet]], 0),
+		make_float4(mesh->n_x[mesh->t_nindex3[tet]], mesh->n_y[mesh->t_nindex3[tet]], mesh->n_z[mesh->t_nindex3[tet]], 0),
+		make_float4(mesh->n_x[mesh->t_nindex4[tet]], mesh->n_y[mesh->t_nindex4[tet]], mesh->n_z[mesh->t_nindex4[tet]], 0) };
+	if (IsPointInTetrahedron(nodes[0], nodes[1], nodes[2], nodes[3], v) == true) return true;
+	else return false;
+}
+
+/* face (0..3, opposite the vertex of the same index) behind which p lies, -1 if p is inside or on tet */
+/* the faces are tested starting with 'first', so a walk does not always prefer the same face */
+int32_t PointOutsideFace(mesh2* mesh, int32_t tet, float4 p, int first)
+{
+	float4 v[4] = {
+		make_float4(mesh->n_x[mesh->t_nindex1[tet]], mesh->n_y[mesh->t_nindex1[tet]], mesh->n_z[mesh->t_nindex1[tet]], 0),
+		make_float4(mesh->n_x[mesh->t_nindex2[tet]], mesh->n_y[mesh->t_nindex2[tet]], mesh->n_z[mesh->t_nindex2[tet]], 0),
+		make_float4(mesh->n_x[mesh->t_nindex3[tet]], mesh->n_y[mesh->t_nindex3[tet]], mesh->n_z[mesh->t_nindex3[tet]], 0),
+		make_float4(mesh->n_x[mesh->t_nindex4[tet]], mesh->n_y[mesh->t_nindex4[tet]], mesh->n_z[mesh->t_nindex4[tet]], 0) };
+	for (int i = 0; i < 4; i++)
+	{
+		int k = (first + i) & 3;
+		const float4 &a = v[(k + 1) & 3], &b = v[(k + 2) & 3], &c = v[(k + 3) & 3];
+		float4 normal = Cross(b - a, c - a);
+		float dotV = Dot(normal, v[k] - a);
+		float dotP = Dot(normal, p - a);
+		if ((dotV > 0 && dotP < 0) || (dotV < 0 && dotP > 0)) return k;
+	}
+	return -1;
+}
+
+// last tetrahedron found per thread, start of the next walk without hint
+static thread_local int32_t tet_locate_seed = 0;
+static thread_local uint32_t tet_locate_random = 2463534242u;
+
+/* linear scan over all tetrahedra, -1 if p is outside of the mesh */
+int32_t ScanTetrahedraForPoint(mesh2* mesh, float4 p)
+{
+	for (int32_t i = 0; i < (int32_t)mesh->tetnum; i++)
+		if (PointOutsideFace(mesh, i, p, 0) == -1) return i;
+	return -1;
+}
+
+/* upper limit of walk steps in GetTetrahedraFromPoint before falling back to the scan */
+#ifndef TET_LOCATE_MAX_STEPS
+#define TET_LOCATE_MAX_STEPS 100000
+#endif
+
+/* locates the tetrahedron containing p by walking over the neighbours from 'hint' (or, if hint is -1, */
+/* from the locate grid cell of p if init_locate_grid() was called, else from the last tetrahedron found */
+/* by this thread): each step leaves through a face p lies behind, the */
+/* first face tested is chosen at random so the walk cannot cycle. A few steps for nearby hints, */
+/* about n^(1/3) otherwise. Returns -1 if the walk leaves the mesh, i.e. p is outside. In a non-convex */
+/* mesh the walk can also leave through a concavity while p is inside, set scan_outside to confirm */
+/* such results by scanning all tetrahedra */
+int32_t GetTetrahedraFromPoint(mesh2* mesh, float4 p, int32_t hint = -1, bool scan_outside = false)
+{
+	if (mesh->tetnum == 0) return -1;
+	int32_t tet = (hint >= 0 && hint < (int32_t)mesh->tetnum) ? hint : (mesh->g_seed != nullptr) ? GridSeedTet(mesh, p) : tet_locate_seed;
+	if (tet < 0 || tet >= (int32_t)mesh->tetnum) tet = 0;
+
+	int32_t* adjtet[4] = { mesh->t_adjtet1, mesh->t_adjtet2, mesh->t_adjtet3, mesh->t_adjtet4 };
+	int32_t prev = -1;
+	for (uint32_t step = 0; step < TET_LOCATE_MAX_STEPS; step++)
+	{
+		tet_locate_random ^= tet_locate_random << 13; tet_locate_random ^= tet_locate_random >> 17; tet_locate_random ^= tet_locate_random << 5;
+		int32_t face = PointOutsideFace(mesh, tet, p, tet_locate_random & 3);
+		// p behind the face the walk came through only: p lies on that face within rounding
+		if (face != -1 && adjtet[face][tet] == prev && prev != -1 && PointOutsideFace(mesh, tet, p, face + 1) == face) face = -1;
+		if (face == -1) { tet_locate_seed = tet; return tet; }
+
+		int32_t next = adjtet[face][tet];
+		if (next < 0) // left the mesh
+		{
+			if (!scan_outside) return -1;
+			break;
+		}
+		prev = tet;
+		tet = next;
+	}
+
+	tet = ScanTetrahedraForPoint(mesh, p);
+	if (tet != -1) tet_locate_seed = tet;
+	return tet;
+}
+
+/* follows a moving point: walks from prev_tet, the tetrahedron of the point's last position, to the one */
+/* containing new_pos, which takes a few steps for small moves. If that walk leaves the mesh, the point is */
+/* located from scratch (locate grid if there is one, else the last tetrahedron found). Returns -1 once the */
+/* point has left the mesh; prev_tet = -1 locates from scratch. In a non-convex mesh, set scan_outside so */
+/* a point moving around a concave boundary is confirmed outside by scanning all tetrahedra; that scan */
+/* then runs on every call while the point stays outside */
+int32_t track_point(mesh2 *mesh, int32_t prev_tet, float4 new_pos, bool scan_outside = false)
+{
+	if (prev_tet >= 0 && prev_tet < (int32_t)mesh->tetnum)
+	{
+		int32_t tet = GetTetrahedraFromPoint(mesh, new_pos, prev_tet);
+		if (tet != -1) return tet;
+	}
+	return GetTetrahedraFromPoint(mesh, new_pos, -1, scan_outside);
+}
+
+/* locates n points at once, out_tets[i] is the tetrahedron of points[i] or -1 (see GetTetrahedraFromPoint) */
+/* the points are sorted along a Morton curve and split into runs for up to 'threads' threads (0 = all */
+/* cores), each point is walked to from the answer of its predecessor on the curve */
+void locate_points(mesh2 *mesh, const float4 *points, size_t n, int32_t *out_tets, unsigned threads = 0, bool scan_outside = false)
+{
+	if (n == 0) return;
+	float4 lo = points[0], hi = points[0];
+	for (size_t i = 1; i < n; i++)
+	{
+		lo.x = std::min(lo.x, points[i].x); lo.y = std::min(lo.y, points[i].y); lo.z = std::min(lo.z, points[i].z);
+		hi.x = std::max(hi.x, points[i].x); hi.y = std::max(hi.y, points[i].y); hi.z = std::max(hi.z, points[i].z);
+	}
+	auto inv = [](float e) { return (e > 0) ? 1.0f / e : 0.0f; };
+	float4 scale = make_float4(inv(hi.x - lo.x), inv(hi.y - lo.y), inv(hi.z - lo.z), 0);
+
+	// Morton code in the high word, point index in the low word
+	std::vector<uint64_t> order(n);
+	tet_parallel_for(n, threads, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++) order[i] = (uint64_t)MortonCode(points[i], lo, scale) << 32 | (uint32_t)i;
+	});
+	std::sort(order.begin(), order.end());
+
+	tet_parallel_for(n, threads, [&](size_t begin, size_t end)
+	{
+		int32_t hint = -1;
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t index = (uint32_t)order[i];
+			int32_t tet = GetTetrahedraFromPoint(mesh, points[index], hint, scan_outside);
+			out_tets[index] = tet;
+			if (tet != -1) hint = tet;
+		}
+	});
+}
+
+BBox init_BBox(mesh2* mesh)
+{
+	BBox boundingbox;
+	boundingbox.min = make_float4(-inf, -inf, -inf, 0);
+	boundingbox.max = make_float4(inf, inf, inf, 0);
+	for (uint32_t i = 0; i < mesh->nodenum; i++)
+	{
+		if (boundingbox.min.x < mesh->n_x[i])  boundingbox.min.x = mesh->n_x[i];
+		if (boundingbox.max.x > mesh->n_x[i])  boundingbox.max.x = mesh->n_x[i];
+		if (boundingbox.min.y < mesh->n_y[i])  boundingbox.min.y = mesh->n_y[i];
+		if (boundingbox.max.y > mesh->n_y[i])  boundingbox.max.y = mesh->n_y[i];
+		if (boundingbox.min.z < mesh->n_z[i])  boundingbox.min.z = mesh->n_z[i];
+		if (boundingbox.max.z > mesh->n_z[i])  boundingbox.max.z = mesh->n_z[i];
+	}
+	return boundingbox;
+}
+
+void ConstrainToBBox(BBox* boundingbox, float4 &p)
+{
+	if (boundingbox->min.x + 0.2 < p.x)  p.x = boundingbox->min.x;
+	if (boundingbox->max.x - 0.2 > p.x)  p.x = boundingbox->max.x;
+	if (boundingbox->min.y + 0.2 < p.y)  p.y = boundingbox->min.y;
+	if (boundingbox->max.y - 0.2 > p.y)  p.y = boundingbox->max.y;
+	if (boundingbox->min.z + 0.2 < p.z)  p.z = boundingbox->min.z;
+	if (boundingbox->max.z - 0.2 > p.z)  p.z = boundingbox->max.z;
+}
+
+//----------------------- robust edge test -----------------------------------------------------------------
+
+/* relative error bound of the float edge products; a product smaller than TET_FILTER_EPS * its */
+/* magnitude bound may have the wrong sign and is evaluated exactly instead */
+#define TET_FILTER_EPS (8.0f * FLT_EPSILON)
+
+// a + b = s + e exactly
+void TwoSum(double a, double b, double &s, double &e)
+{
+	s = a + b;
+	double bv = s - a;
+	e = (a - (s - bv)) + (b - bv);
+}
+
+/* sign of the exact sum of n doubles, accumulated as a nonoverlapping expansion (Shewchuk 1997) */
+int ExpansionSign(const double* terms, int n)
+{
+	double e[64], h[64];
+	int m = 0;
+	for (int t = 0; t < n; t++)
+	{
+		double q = terms[t], sum, err;
+		int k = 0;
+		for (int i = 0; i < m; i++)
+		{
+			TwoSum(q, e[i], sum, err);
+			if (err != 0) h[k++] = err;
+			q = sum;
+		}
+		if (q != 0) h[k++] = q;
+		for (int i = 0; i < k; i++) e[i] = h[i];
+		m = k;
+	}
+	if (m == 0) return 0;
+	return (e[m - 1] > 0) ? 1 : -1; // the largest component decides
+}
+
+// adds the exact value of s * u * v (floats) to terms as two doubles
+void ExactProduct3(float s, float u, float v, double* terms, int &n)
+{
+	double uv = (double)u * (double)v; // exact, 48 bits
+	double hi = uv * (double)s;
+	terms[n++] = hi;
+	terms[n++] = std::fma(uv, (double)s, -hi);
+}
+
+// adds the exact value of Dot(q, Cross(u, v)) to terms
+void ExactScTP(float4 q, float4 u, float4 v, double* terms, int &n)
+{
+	ExactProduct3(q.x, u.y, v.z, terms, n); ExactProduct3(-q.x, u.z, v.y, terms, n);
+	ExactProduct3(q.y, u.z, v.x, terms, n); ExactProduct3(-q.y, u.x, v.z, terms, n);
+	ExactProduct3(q.z, u.x, v.y, terms, n); ExactProduct3(-q.z, u.y, v.x, terms, n);
+}
+
+/* the last terms of the tie break of ExactEdgeSign(), for a ray along the edge line a -> b: nx, ny are the */
+/* signs of the x and y components of (a - o) x (b - o), side[k] the sign of component k of a - b. A */
+/* nonzero edge always gives a side */
+int EdgeLineSign(int nx, int ny, const int side[3])
+{
+	// the direction moves by (e^4, e^8, e^12): the terms e^4 nx, e^6 side.z, e^7 -side.y, e^8 ny, e^11 side.x
+	// in this order, the mixed ones from moving origin and direction together; the others are zero
+	if (nx != 0) return nx;
+	if (side[2] != 0) return side[2];
+	if (side[1] != 0) return -side[1];
+	if (ny != 0) return ny;
+	return side[0];
+}
+
+/* exact sign of ScTP(q, a - o, b - o), the side of the ray o + t q against the edge a -> b */
+/* ties are broken by simulation of simplicity: the ray origin is moved by (e, e^2, e^3) and the direction */
+/* by (e^4, e^8, e^12) for an infinitesimal e, which is a real perturbation of the ray, so all tetrahedra */
+/* around an edge agree on the side, also for rays running along the edge. 0 is returned only if a == b */
+int ExactEdgeSign(float4 o, float4 q, float4 a, float4 b)
+{
+	// double precision first: differences of floats and their products are exact, only the sums round
+	double ax = (double)a.x - o.x, ay = (double)a.y - o.y, az = (double)a.z - o.z;
+	double bx = (double)b.x - o.x, by = (double)b.y - o.y, bz = (double)b.z - o.z;
+	double det = q.x * (ay * bz - az * by) + q.y * (az * bx - ax * bz) + q.z * (ax * by - ay * bx);
+	double perm = fabs(q.x) * (fabs(ay * bz) + fabs(az * by)) + fabs(q.y) * (fabs(az * bx) + fabs(ax * bz)) + fabs(q.z) * (fabs(ax * by) + fabs(ay * bx));
+	if (fabs(det) > 8.0 * DBL_EPSILON * perm) return (det > 0) ? 1 : -1;
+
+	// (a - o) x (b - o) = a x b + o x a + b x o, summed exactly
+	double terms[36];
+	int n = 0;
+	ExactScTP(q, a, b, terms, n);
+	ExactScTP(q, o, a, terms, n);
+	ExactScTP(q, b, o, terms, n);
+	int s = ExpansionSign(terms, n);
+	if (s != 0) return s;
+
+	// d/do of the product is (a - b) x q, taken component by component
+	double t[8];
+	n = 0;
+	t[n++] = (double)a.y * q.z; t[n++] = -(double)b.y * q.z; t[n++] = -(double)a.z * q.y; t[n++] = (double)b.z * q.y;
+	if ((s = ExpansionSign(t, n)) != 0) return s;
+	n = 0;
+	t[n++] = (double)a.z * q.x; t[n++] = -(double)b.z * q.x; t[n++] = -(double)a.x * q.z; t[n++] = (double)b.x * q.z;
+	if ((s = ExpansionSign(t, n)) != 0) return s;
+	n = 0;
+	t[n++] = (double)a.x * q.y; t[n++] = -(double)b.x * q.y; t[n++] = -(double)a.y * q.x; t[n++] = (double)b.y * q.x;
+	if ((s = ExpansionSign(t, n)) != 0) return s;
+
+	// the ray runs along the edge line, d/dq of the product is (a - o) x (b - o)
+	double nx[6] = { (double)a.y * b.z, -(double)a.z * b.y, (double)o.y * a.z, -(double)o.z * a.y, (double)b.y * o.z, -(double)b.z * o.y };
+	double ny[6] = { (double)a.z * b.x, -(double)a.x * b.z, (double)o.z * a.x, -(double)o.x * a.z, (double)b.z * o.x, -(double)b.x * o.z };
+	int side[3] = { (a.x > b.x) - (a.x < b.x), (a.y > b.y) - (a.y < b.y), (a.z > b.z) - (a.z < b.z) };
+	return EdgeLineSign(ExpansionSign(nx, 6), ExpansionSign(ny, 6), side);
+}
+
+/* ExactEdgeSign for the coordinates relative to the ray origin of the precision templates, o = 0 */
+int ExactEdgeSign(const tet_vec3<float> &q, const tet_vec3<float> &a, const tet_vec3<float> &b)
+{
+	return ExactEdgeSign(make_float4(0, 0, 0, 0), make_float4(q.x, q.y, q.z, 0), make_float4(a.x, a.y, a.z, 0), make_float4(b.x, b.y, b.z, 0));
+}
+
+// a * b = p + e exactly
+void TwoProduct(double a, double b, double &p, double &e)
+{
+	p = a * b;
+	e = std::fma(a, b, -p);
+}
+
+// adds the exact value of s * u * v (doubles) to terms as four doubles
+void ExactProduct3(double s, double u, double v, double* terms, int &n)
+{
+	double h, l;
+	TwoProduct(u, v, h, l);
+	TwoProduct(s, h, terms[n], terms[n + 1]);
+	TwoProduct(s, l, terms[n + 2], terms[n + 3]);
+	n += 4;
+}
+
+/* exact sign of ScTP(q, a, b) in double precision, ties broken like ExactEdgeSign(); o = 0 */
+int ExactEdgeSign(const tet_vec3<double> &q, const tet_vec3<double> &a, const tet_vec3<double> &b)
+{
+	tet_vec3<double> ab = Cross(a, b);
+	double det = Dot(q, ab);
+	double perm = fabs(q.x) * (fabs(a.y * b.z) + fabs(a.z * b.y)) + fabs(q.y) * (fabs(a.z * b.x) + fabs(a.x * b.z)) + fabs(q.z) * (fabs(a.x * b.y) + fabs(a.y * b.x));
+	if (fabs(det) > 8.0 * DBL_EPSILON * perm) return (det > 0) ? 1 : -1;
+
+	double terms[24];
+	int n = 0;
+	ExactProduct3(q.x, a.y, b.z, terms, n); ExactProduct3(-q.x, a.z, b.y, terms, n);
+	ExactProduct3(q.y, a.z, b.x, terms, n); ExactProduct3(-q.y, a.x, b.z, terms, n);
+	ExactProduct3(q.z, a.x, b.y, terms, n); ExactProduct3(-q.z, a.y, b.x, terms, n);
+	int s = ExpansionSign(terms, n);
+	if (s != 0) return s;
+
+	// the components of (a - b) x q, see ExactEdgeSign()
+	double t[8];
+	TwoProduct(a.y, q.z, t[0], t[1]); TwoProduct(-b.y, q.z, t[2], t[3]); TwoProduct(-a.z, q.y, t[4], t[5]); TwoProduct(b.z, q.y, t[6], t[7]);
+	if ((s = ExpansionSign(t, 8)) != 0) return s;
+	TwoProduct(a.z, q.x, t[0], t[1]); TwoProduct(-b.z, q.x, t[2], t[3]); TwoProduct(-a.x, q.z, t[4], t[5]); TwoProduct(b.x, q.z, t[6], t[7]);
+	if ((s = ExpansionSign(t, 8)) != 0) return s;
+	TwoProduct(a.x, q.y, t[0], t[1]); TwoProduct(-b.x, q.y, t[2], t[3]); TwoProduct(-a.y, q.x, t[4], t[5]); TwoProduct(b.y, q.x, t[6], t[7]);
+	if ((s = ExpansionSign(t, 8)) != 0) return s;
+
+	// along the edge line: the x and y components of a x b
+	double nx[4], ny[4];
+	TwoProduct(a.y, b.z, nx[0], nx[1]); TwoProduct(-a.z, b.y, nx[2], nx[3]);
+	TwoProduct(a.z, b.x, ny[0], ny[1]); TwoProduct(-a.x, b.z, ny[2], ny[3]);
+	int side[3] = { SignOf(a.x - b.x), SignOf(a.y - b.y), SignOf(a.z - b.z) };
+	return EdgeLineSign(ExpansionSign(nx, 4), ExpansionSign(ny, 4), side);
+}
+
+// local vertices of the edges AB BC AC AD BD CD
+static const int32_t tet_edge_vertex[6][2] = { { 0, 1 }, { 1, 2 }, { 0, 2 }, { 0, 3 }, { 1, 3 }, { 2, 3 } };
+
+/* replaces the products whose magnitude is below bound[i] by their exact sign */
+void ResolveUncertainProducts(float Q[6], const float bound[6], float4 ray_o, float4 ray_d, const float4* nodes)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		if (fabsf(Q[i]) > bound[i]) continue;
+		Q[i] = (float)ExactEdgeSign(ray_o, ray_d, nodes[tet_edge_vertex[i][0]], nodes[tet_edge_vertex[i][1]]);
+	}
+}
+
+void GetExitFromProducts(const float Q[6], int32_t findex[4], int32_t adjtet[4], int32_t lface, int32_t &face, int32_t &tet);
+
+/* triple products of the ray with the edges AB BC AC AD BD CD of the tetrahedron 'nodes' */
+/* products too close to zero for their float sign to be trusted are decided by ExactEdgeSign() */
+void GetEdgeProducts(float4 ray_o, float4 ray_d, const float4* nodes, float Q[6])
+{
+	// http://realtimecollisiondetection.net/blog/?p=13
+	// and https://github.com/JKolios/RayTetra/blob/master/RayTetra/RayTetraSTP0.cl
+
+	// translate Ray to origin and vertices same as ray
+	float4 q = ray_d;
+
+	float4 v0 = make_float4(nodes[0].x, nodes[0].y, nodes[0].z, 0); // A
+	float4 v1 = make_float4(nodes[1].x, nodes[1].y, nodes[1].z, 0); // B
+	float4 v2 = make_float4(nodes[2].x, nodes[2].y, nodes[2].z, 0); // C
+	float4 v3 = make_float4(nodes[3].x, nodes[3].y, nodes[3].z, 0); // D
+
+	float4 p0 = v0 - ray_o;
+	float4 p1 = v1 - ray_o;
+	float4 p2 = v2 - ray_o;
+	float4 p3 = v3 - ray_o;
+
+	// ScTP(q, pi, pj) = Dot(pj, Cross(q, pi)): the six edge products share three cross products
+	float4 qA = Cross(q, p0);
+	float4 qB = Cross(q, p1);
+	float4 qC = Cross(q, p2);
+
+	Q[0] = Dot(p1, qA); // A B
+	Q[1] = Dot(p2, qB); // B C
+	Q[2] = Dot(p2, qA); // A C
+	Q[3] = Dot(p3, qA); // A D
+	Q[4] = Dot(p3, qB); // B D
+	Q[5] = Dot(p3, qC); // C D
+
+	// every monomial of a product is at most qmax * pmax^2
+	float pmax = std::max(std::max(MaxAbs(p0), MaxAbs(p1)), std::max(MaxAbs(p2), MaxAbs(p3)));
+	float bound = TET_FILTER_EPS * 6.0f * MaxAbs(q) * pmax * pmax;
+	if (fabsf(Q[0]) <= bound || fabsf(Q[1]) <= bound || fabsf(Q[2]) <= bound || fabsf(Q[3]) <= bound || fabsf(Q[4]) <= bound || fabsf(Q[5]) <= bound)
 	{
-		if (sQAD > 0 && sQAC < 0 && sQCD < 0) { face = findex[1]; tet = adjtet[1]; } // exit face
+		float bounds[6] = { bound, bound, bound, bound, bound, bound };
+		ResolveUncertainProducts(Q, bounds, ray_o, ray_d, nodes);
 	}
+}
+
+/* finds the face through which the ray leaves the tetrahedron; findex[i]/adjtet[i] is the face opposite to vertex i */
+/* lface is the face the ray entered through (-1 in the start tetrahedron) and is not tested again */
+/* face = tet = -1 if no exit face exists, i.e. the ray line misses the tetrahedron */
+void GetExitTet(float4 ray_o, float4 ray_d, float4* nodes, int32_t findex[4], int32_t adjtet[4], int32_t lface, int32_t &face, int32_t &tet)
+{
+	float Q[6];
+	GetEdgeProducts(ray_o, ray_d, nodes, Q);
+	GetExitFromProducts(Q, findex, adjtet, lface, face, tet);
+}
+
+/* picks the exit face from the triple products of the ray with the edges AB BC AC AD BD CD */
+/* the sign tests are branches on purpose: on a single ray the predicted exit lets the CPU fetch the next */
+/* tetrahedron before the products are known, which beats the lookup of ExitSlotOfMask() there */
+void GetExitFromProducts(const float Q[6], int32_t findex[4], int32_t adjtet[4], int32_t lface, int32_t &face, int32_t &tet)
+{
+	float QAB = Q[0], QBC = Q[1], QAC = Q[2], QAD = Q[3], QBD = Q[4], QCD = Q[5];
+	face = -1;
+	tet = -1;
+
+	// the entry face cannot be the exit face
+	// ABC
+	if (findex[3] != lface && QAB < 0 && QAC > 0 && QBC < 0) { face = findex[3]; tet = adjtet[3]; } // exit face
+	// BAD
+	if (findex[2] != lface && QAB > 0 && QAD < 0 && QBD > 0) { face = findex[2]; tet = adjtet[2]; } // exit face
+	// CDA
+	if (findex[1] != lface && QAD > 0 && QAC < 0 && QCD < 0) { face = findex[1]; tet = adjtet[1]; } // exit face
 	// DCB
-	if (sQBC != 0 && sQBD != 0 && sQCD != 0)
+	if (findex[0] != lface && QBC > 0 && QBD < 0 && QCD > 0) { face = findex[0]; tet = adjtet[0]; } // exit face
+	// No face hit: face == -1 && tet == -1
+}
+
+/* exit slot by the signs of the six edge products: index bit i is set if product i (AB BC AC AD BD CD) is */
+/* positive; every sign pattern has at most one exit face, -1 if there is none */
+static const int8_t tet_exit_slot[64] = {
+	-1, -1, -1, -1, 3, -1, -1, -1, 1, 1, 1, 1, 3, -1, -1, -1,
+	-1, 2, -1, 2, 3, 2, -1, 2, 1, 1, 1, 1, 3, -1, -1, -1,
+	-1, -1, 0, 0, 3, -1, 0, 0, -1, -1, 0, 0, 3, -1, 0, 0,
+	-1, 2, -1, 2, 3, 2, -1, 2, -1, -1, -1, -1, 3, -1, -1, -1 };
+
+/* GetExitSlotFromProducts without branches for products that are all nonzero, packed into a sign mask */
+/* (see tet_exit_slot); keep has bit k set if face k may be the exit, i.e. is not the entry face */
+int ExitSlotOfMask(uint32_t mask, uint32_t keep)
+{
+	int slot = tet_exit_slot[mask];
+	return (slot >= 0 && ((keep >> slot) & 1)) ? slot : -1;
+}
+
+/* GetExitFromProducts by local face: the exit slot of the tetrahedron entered through slot lslot, -1 if none */
+int GetExitSlotFromProducts(const float Q[6], int lslot)
+{
+	float QAB = Q[0], QBC = Q[1], QAC = Q[2], QAD = Q[3], QBD = Q[4], QCD = Q[5];
+	if (lslot != 0 && QBC > 0 && QBD < 0 && QCD > 0) return 0; // DCB
+	if (lslot != 1 && QAD > 0 && QAC < 0 && QCD < 0) return 1; // CDA
+	if (lslot != 2 && QAB > 0 && QAD < 0 && QBD > 0) return 2; // BAD
+	if (lslot != 3 && QAB < 0 && QAC > 0 && QBC < 0) return 3; // ABC
+	return -1;
+}
+
+
+/* nodes of tet for the node based exit tests, from the vertex cache if there is one and no Plücker table */
+/* (which decides on the mesh nodes), else from the mesh; n are the node indices of tet or nullptr */
+void GetTraversalNodes(mesh2 *mesh, int32_t tet, const int32_t* n, float4 nodes[4])
+{
+	if (mesh->t_verts != nullptr && mesh->e_plucker == nullptr)
+	{
+		const float* v = mesh->t_verts + 12 * (size_t)tet;
+		for (int k = 0; k < 4; k++) nodes[k] = make_float4(v[3 * k], v[3 * k + 1], v[3 * k + 2], 0);
+	}
+	else if (mesh->t_cverts != nullptr && mesh->e_plucker == nullptr)
+	{
+		// lattice point times a power of two is exact, so shared nodes agree bit for bit
+		const tet_vertex_compact &v = mesh->t_cverts[tet];
+		float h = mesh->v_cell;
+		nodes[0] = make_float4((float)v.origin[0] * h, (float)v.origin[1] * h, (float)v.origin[2] * h, 0);
+		for (int k = 1; k < 4; k++)
+			nodes[k] = make_float4((float)(v.origin[0] + v.delta[k - 1][0]) * h, (float)(v.origin[1] + v.delta[k - 1][1]) * h, (float)(v.origin[2] + v.delta[k - 1][2]) * h, 0);
+	}
+	else if (n != nullptr)
+	{
+		for (int k = 0; k < 4; k++) nodes[k] = make_float4(mesh->n_x[n[k]], mesh->n_y[n[k]], mesh->n_z[n[k]], 0);
+	}
+	else GetTetNodes(mesh, tet, nodes);
+}
+
+/* edge products of the ray with tetrahedron 'tet', from the Plücker table if there is one, else from the */
+/* nodes n (nullptr: read from the mesh). rayw = Cross(rayo, rayd) is only used with the Plücker table */
+void GetTetProducts(mesh2 *mesh, int32_t tet, const int32_t* n, float4 rayo, float4 rayd, float4 rayw, float Q[6])
+{
+	float4 nodes[4];
+	if (mesh->e_plucker != nullptr)
+	{
+		// side of the ray against each edge: Dot(d, rayw) + Dot(m, rayd), no node access needed
+		// L[6] bounds the edge's coordinates, giving the error bound of the side test
+		float bound[6];
+		bool uncertain = false;
+		float qmax = MaxAbs(rayd);
+		float omax = MaxAbs(rayo);
+		const int32_t* e = mesh->t_edges + 6 * (size_t)tet;
+		for (int i = 0; i < 6; i++)
+		{
+			const float* L = mesh->e_plucker + 8 * (size_t)(e[i] >> 1);
+			float side = L[0] * rayw.x + L[1] * rayw.y + L[2] * rayw.z + L[3] * rayd.x + L[4] * rayd.y + L[5] * rayd.z;
+			Q[i] = (e[i] & 1) ? -side : side;
+			bound[i] = TET_FILTER_EPS * qmax * L[6] * (6.0f * L[6] + 12.0f * omax);
+			uncertain |= fabsf(side) <= bound[i];
+		}
+		if (uncertain)
+		{
+			GetTraversalNodes(mesh, tet, n, nodes);
+			ResolveUncertainProducts(Q, bound, rayo, rayd, nodes);
+		}
+	}
+	else
 	{
-		if (sQBC > 0 && sQBD < 0 && sQCD > 0) { face = findex[0]; tet = adjtet[0]; } // exit face
+		GetTraversalNodes(mesh, tet, n, nodes);
+		GetEdgeProducts(rayo, rayd, nodes, Q);
 	}
-	// No face hit
-	// if (face == 0 && tet == 0) { printf("Error! No exit tet found. \n"); }
 }
 
+/* exit slot of the packed record r of 'tet' for a ray entered through slot lslot (-1 in the start tetrahedron) */
+int GetExitSlot(mesh2 *mesh, const tet_record &r, int32_t tet, float4 rayo, float4 rayd, float4 rayw, int lslot)
+{
+	float Q[6];
+	GetTetProducts(mesh, tet, r.node, rayo, rayd, rayw, Q);
+	return GetExitSlotFromProducts(Q, lslot);
+}
+
+/* exit face and next tetrahedron of 'tet'; rayw = Cross(rayo, rayd) is only used with the Plücker table */
+void GetExitTet(mesh2 *mesh, int32_t tet, float4 rayo, float4 rayd, float4 rayw, int32_t lface, int32_t &face, int32_t &nexttet)
+{
+	if (mesh->t_packed != nullptr)
+	{
+		const tet_record &r = mesh->t_packed[tet];
+		int lslot = -1;
+		for (int k = 0; k < 4; k++) if (r.face[k] == lface) lslot = k;
+		int slot = GetExitSlot(mesh, r, tet, rayo, rayd, rayw, lslot);
+		face = (slot < 0) ? -1 : r.face[slot];
+		nexttet = (slot < 0 || r.adj[slot] < 0) ? -1 : r.adj[slot] >> 2;
+		return;
+	}
+	int32_t findex[4] = { mesh->t_findex1[tet], mesh->t_findex2[tet], mesh->t_findex3[tet], mesh->t_findex4[tet] };
+	int32_t adjtets[4] = { mesh->t_adjtet1[tet], mesh->t_adjtet2[tet], mesh->t_adjtet3[tet], mesh->t_adjtet4[tet] };
+	float Q[6];
+	GetTetProducts(mesh, tet, nullptr, rayo, rayd, rayw, Q);
+	GetExitFromProducts(Q, findex, adjtets, lface, face, nexttet);
+}
+
+/* nodes of tet relative to o: the differences are taken in the precision S of o (from the double nodes */
+/* if the mesh has them, see init_double_nodes()) and rounded to the precision T of the exit test. Every */
+/* tetrahedron rounds a shared node the same way, so the walk stays watertight */
+template <typename T, typename S>
+void GetRelativeNodes(mesh2 *mesh, int32_t tet, const tet_vec3<S> &o, tet_vec3<T> p[4])
+{
+	int32_t n[4];
+	if (mesh->t_packed != nullptr) for (int k = 0; k < 4; k++) n[k] = mesh->t_packed[tet].node[k];
+	else { n[0] = mesh->t_nindex1[tet]; n[1] = mesh->t_nindex2[tet]; n[2] = mesh->t_nindex3[tet]; n[3] = mesh->t_nindex4[tet]; }
+	for (int k = 0; k < 4; k++)
+	{
+		S x = (mesh->n_xd != nullptr) ? (S)mesh->n_xd[n[k]] : (S)mesh->n_x[n[k]];
+		S y = (mesh->n_yd != nullptr) ? (S)mesh->n_yd[n[k]] : (S)mesh->n_y[n[k]];
+		S z = (mesh->n_zd != nullptr) ? (S)mesh->n_zd[n[k]] : (S)mesh->n_z[n[k]];
+		p[k] = make_vec3((T)(x - o.x), (T)(y - o.y), (T)(z - o.z));
+	}
+}
+
+// relative error bound of the product filters ('epsilon' is taken by the tetgen macro)
+float TetFilterEps(float) { return 8.0f * FLT_EPSILON; }
+double TetFilterEps(double) { return 8.0 * DBL_EPSILON; }
+
+/* the edge products AB BC AC AD BD CD of GetEdgeProducts() in precision T, for a ray from the origin in */
+/* direction q and the nodes p relative to the ray origin; uncertain signs are decided exactly on p */
+template <typename T>
+void GetEdgeProducts(const tet_vec3<T> &q, const tet_vec3<T> p[4], T Q[6])
+{
+	tet_vec3<T> qA = Cross(q, p[0]), qB = Cross(q, p[1]), qC = Cross(q, p[2]);
+	Q[0] = Dot(p[1], qA); // A B
+	Q[1] = Dot(p[2], qB); // B C
+	Q[2] = Dot(p[2], qA); // A C
+	Q[3] = Dot(p[3], qA); // A D
+	Q[4] = Dot(p[3], qB); // B D
+	Q[5] = Dot(p[3], qC); // C D
+
+	T pmax = std::max(std::max(MaxAbs(p[0]), MaxAbs(p[1])), std::max(MaxAbs(p[2]), MaxAbs(p[3])));
+	T bound = TetFilterEps(T()) * (T)6 * MaxAbs(q) * pmax * pmax;
+	for (int i = 0; i < 6; i++)
+	{
+		if (std::abs(Q[i]) <= bound) Q[i] = (T)ExactEdgeSign(q, p[tet_edge_vertex[i][0]], p[tet_edge_vertex[i][1]]);
+	}
+}
+
+/* edge products of the ray with tet in precision T, from the nodes relative to the ray origin; exact */
+/* fallbacks perturb these relative coordinates */
+template <typename T, typename S>
+void GetRayProducts(mesh2 *mesh, int32_t tet, const tet_vec3<S> &rayo, const tet_vec3<T> &rayd, T Q[6])
+{
+	tet_vec3<T> p[4];
+	GetRelativeNodes(mesh, tet, rayo, p);
+	GetEdgeProducts(rayd, p, Q);
+}
+
+/* float rays take the node based float4 test: its exact fallbacks perturb the absolute coordinates, so */
+/* the results equal traverse_ray with float4 rays on a mesh without Plücker table */
+void GetRayProducts(mesh2 *mesh, int32_t tet, const tet_vec3<float> &rayo, const tet_vec3<float> &rayd, float Q[6])
+{
+	float4 nodes[4];
+	GetTetNodes(mesh, tet, nodes);
+	GetEdgeProducts(make_float4(rayo.x, rayo.y, rayo.z, 0), make_float4(rayd.x, rayd.y, rayd.z, 0), nodes, Q);
+}
+
+/* GetExitTet with the exit test in the precision T of the ray direction, for a ray origin in precision S: */
+/* float (S = T = float), double (S = T = double) or mixed (S = double, T = float), where the nodes are */
+/* taken relative to the ray origin in double and the products computed in float. This keeps the digits */
+/* of large coordinates (e.g. UTM) at about float speed. The Plücker table and the vertex cache are not used */
+template <typename T, typename S>
+void GetExitTet(mesh2 *mesh, int32_t tet, const tet_vec3<S> &rayo, const tet_vec3<T> &rayd, int32_t lface, int32_t &face, int32_t &nexttet)
+{
+	T Q[6];
+	GetRayProducts(mesh, tet, rayo, rayd, Q);
+	float sign[6]; // double products may be too small for a float, their signs are what counts
+	for (int i = 0; i < 6; i++) sign[i] = (float)SignOf(Q[i]);
+
+	int32_t findex[4], adjtets[4];
+	if (mesh->t_packed != nullptr)
+	{
+		const tet_record &r = mesh->t_packed[tet];
+		for (int k = 0; k < 4; k++) { findex[k] = r.face[k]; adjtets[k] = (r.adj[k] < 0) ? -1 : r.adj[k] >> 2; }
+	}
+	else
+	{
+		findex[0] = mesh->t_findex1[tet]; findex[1] = mesh->t_findex2[tet]; findex[2] = mesh->t_findex3[tet]; findex[3] = mesh->t_findex4[tet];
+		adjtets[0] = mesh->t_adjtet1[tet]; adjtets[1] = mesh->t_adjtet2[tet]; adjtets[2] = mesh->t_adjtet3[tet]; adjtets[3] = mesh->t_adjtet4[tet];
+	}
+	GetExitFromProducts(sign, findex, adjtets, lface, face, nexttet);
+}
+
+/* IsPointInThisTet in the precision of p, with the nodes taken relative to p */
+template <typename S>
+bool IsPointInThisTet(mesh2* mesh, const tet_vec3<S> &p, int32_t tet)
+{
+	tet_vec3<S> v[4];
+	GetRelativeNodes(mesh, tet, p, v);
+	return IsPointInTetrahedron(v[0], v[1], v[2], v[3], make_vec3<S>(0, 0, 0));
+}
+
+/* default number of tetrahedra a ray may cross before it is reported 'dark' */
+#ifndef TET_MAX_STEPS
+#define TET_MAX_STEPS 80
+#endif
+
+/* records a hit in d if the ray leaving current_tet through nextface (flags of the face given) into nexttet stops there */
+bool ray_step_hit(int32_t current_tet, int32_t nextface, int32_t nexttet, bool constrained, bool wall, rayhit &d)
+{
+	bool hitfound = false;
+	if (nextface == -1) { d.lost = true; d.face = nextface; d.tet = current_tet; hitfound = true; } // no exit face, ray stops
+	else
+	{
+		if (constrained) { d.constrained = true; d.face = nextface; d.tet = current_tet; hitfound = true; } // vorher tet = nexttet
+		if (wall) { d.wall = true; d.face = nextface; d.tet = current_tet; hitfound = true; } // vorher tet = nexttet
+		if (nexttet == -1) { d.wall = true; d.face = nextface; d.tet = current_tet; hitfound = true; } // when adjacent tetrahedra is -1, ray stops
+	}
+	return hitfound;
+}
+
+/* records a hit in d if the ray leaving current_tet through nextface into nexttet stops there */
+bool ray_step_hit(mesh2 *mesh, int32_t current_tet, int32_t nextface, int32_t nexttet, rayhit &d)
+{
+	bool constrained = false, wall = false;
+	if (nextface != -1 && mesh->t_packed != nullptr)
+	{
+		// the flags of the record of current_tet, which the step has just read
+		const tet_record &r = mesh->t_packed[current_tet];
+		for (int k = 0; k < 4; k++) if (r.face[k] == nextface) { constrained = (r.flags >> k) & 1; wall = (r.flags >> (4 + k)) & 1; }
+	}
+	else if (nextface != -1)
+	{
+		constrained = mesh->face_is_constrained[nextface];
+		wall = mesh->face_is_wall[nextface];
+	}
+	return ray_step_hit(current_tet, nextface, nexttet, constrained, wall, d);
+}
+
+// true if the point lies in tet or on its boundary, up to about float precision, from the double nodes if there are any
+bool IsPointNearTet(mesh2 *mesh, int32_t tet, double x, double y, double z)
+{
+	int32_t n[4] = { mesh->t_nindex1[tet], mesh->t_nindex2[tet], mesh->t_nindex3[tet], mesh->t_nindex4[tet] };
+	tet_vec3<double> v[4];
+	for (int k = 0; k < 4; k++)
+	{
+		if (mesh->n_xd != nullptr) v[k] = make_vec3(mesh->n_xd[n[k]] - x, mesh->n_yd[n[k]] - y, mesh->n_zd[n[k]] - z);
+		else v[k] = make_vec3((double)mesh->n_x[n[k]] - x, (double)mesh->n_y[n[k]] - y, (double)mesh->n_z[n[k]] - z);
+	}
+	// barycentric coordinates of the origin, each volume with the point in place of one node
+	double vol = Dot(v[1] - v[0], Cross(v[2] - v[0], v[3] - v[0]));
+	double l[4] = { Dot(v[1], Cross(v[2], v[3])), -Dot(v[0], Cross(v[2], v[3])), Dot(v[0], Cross(v[1], v[3])), -Dot(v[0], Cross(v[1], v[2])) };
+	for (int k = 0; k < 4; k++) if (l[k] * vol < -1e-6 * vol * vol) return false;
+	return true;
+}
+
+/* the start tetrahedron for a ray whose origin lies on a face, edge or vertex of 'start': the tie break */
+/* of ExactEdgeSign() moves the origin off it, possibly into a neighbour of 'start', and the ray line then */
+/* misses 'start'. Searches the tetrahedra around the origin (at most 64, connected through their faces) */
+/* for one with an exit face, has_exit(tet); returns 'start' if there is none. The traversal functions call */
+/* it only when the start tetrahedron has no exit face */
+template <typename F>
+int32_t FindRayStartTet(mesh2 *mesh, double x, double y, double z, int32_t start, F has_exit)
+{
+	int32_t queue[64];
+	int count = 1;
+	queue[0] = start;
+	for (int i = 0; i < count; i++)
+	{
+		int32_t t = queue[i];
+		if (i > 0 && has_exit(t)) return t;
+		int32_t adj[4] = { mesh->t_adjtet1[t], mesh->t_adjtet2[t], mesh->t_adjtet3[t], mesh->t_adjtet4[t] };
+		for (int k = 0; k < 4 && count < 64; k++)
+		{
+			if (adj[k] < 0 || std::find(queue, queue + count, adj[k]) != queue + count) continue;
+			if (IsPointNearTet(mesh, adj[k], x, y, z)) queue[count++] = adj[k];
+		}
+	}
+	return start;
+}
+
+// FindRayStartTet for the float rays of the traversal functions
+int32_t FindRayStartTet(mesh2 *mesh, float4 rayo, float4 rayd, int32_t start)
+{
+	float4 rayw = Cross(rayo, rayd);
+	return FindRayStartTet(mesh, rayo.x, rayo.y, rayo.z, start, [&](int32_t t)
+	{
+		int32_t face, next;
+		GetExitTet(mesh, t, rayo, rayd, rayw, -1, face, next);
+		return face != -1;
+	});
+}
 
 /* traverse the mesh until a 'wall' or 'constrained' triangle face is found */
 /* the indices of the face and the tetrahedron which are hit are stored in the rayhit structure */
-void traverse_ray(mesh2 *mesh, float4 rayo, float4 rayd, int32_t start, rayhit &d)
+/* the walk stops at the hit or after max_steps tetrahedra, d.depth holds the number of steps taken */
+/* a start of -1 (origin outside of the mesh, see GetTetrahedraFromPoint) marks the ray lost */
+void traverse_ray(mesh2 *mesh, float4 rayo, float4 rayd, int32_t start, rayhit &d, int max_steps = TET_MAX_STEPS)
 {
+	if (start < 0 || start >= (int32_t)mesh->tetnum) { d.depth = 0; d.lost = true; d.tet = -1; d.face = -1; return; } // origin outside of the mesh
 	int32_t current_tet = start;
-	int32_t nexttet, nextface, lastface = 0;
+	int32_t nexttet = -1, nextface = -1, lastface = -1;
+	float4 rayw = Cross(rayo, rayd);
 	bool hitfound = false;
 
-	for (d.depth = 0; d.depth < 80; d.depth++)
+	int lslot = -1;
+
+	for (d.depth = 0; !hitfound && d.depth < max_steps; d.depth++)
 	{
-		if (!hitfound)
+		if (mesh->t_packed != nullptr)
 		{
-			int32_t findex[4] = { mesh->t_findex1[current_tet], mesh->t_findex2[current_tet], mesh->t_findex3[current_tet], mesh->t_findex4[current_tet] };
-			int32_t adjtets[4] = { mesh->t_adjtet1[current_tet], mesh->t_adjtet2[current_tet], mesh->t_adjtet3[current_tet], mesh->t_adjtet4[current_tet] };
-			float4 nodes[4] = {
-				make_float4(mesh->n_x[mesh->t_nindex1[current_tet]], mesh->n_y[mesh->t_nindex1[current_tet]], mesh->n_z[mesh->t_nindex1[current_tet]], 0),
-				make_float4(mesh->n_x[mesh->t_nindex2[current_tet]], mesh->n_y[mesh->t_nindex2[current_tet]], mesh->n_z[mesh->t_nindex2[current_tet]], 0),
-				make_float4(mesh->n_x[mesh->t_nindex3[current_tet]], mesh->n_y[mesh->t_nindex3[current_tet]], mesh->n_z[mesh->t_nindex3[current_tet]], 0),
-				make_float4(mesh->n_x[mesh->t_nindex4[current_tet]], mesh->n_y[mesh->t_nindex4[current_tet]], mesh->n_z[mesh->t_nindex4[current_tet]], 0) };
-
-			GetExitTet(rayo, rayd, nodes, findex, adjtets, lastface, nextface, nexttet);
-
-			if (mesh->face_is_constrained[nextface] == true) { d.constrained = true; d.face = nextface; d.tet = current_tet; hitfound = true; } // vorher tet = nexttet
-			if (mesh->face_is_wall[nextface] == true) { d.wall = true; d.face = nextface; d.tet = current_tet; hitfound = true; } // vorher tet = nexttet
-			if (nexttet == -1 || nextface == -1) { d.wall = true; d.face = nextface; d.tet = current_tet; hitfound = true; } // when adjacent tetrahedra is -1, ray stops
+			// packed records: the slot of the entry face comes with the neighbour index
+			const tet_record &r = mesh->t_packed[current_tet];
+			int slot = GetExitSlot(mesh, r, current_tet, rayo, rayd, rayw, lslot);
+			int32_t adj = (slot < 0) ? -1 : r.adj[slot];
+			uint32_t flags = (slot < 0) ? 0 : r.flags >> slot;
+			nextface = (slot < 0) ? -1 : r.face[slot];
+			nexttet = (adj < 0) ? -1 : adj >> 2;
+			lslot = adj & 3;
+			if (nextface == -1 && d.depth == 0 && (nexttet = FindRayStartTet(mesh, rayo, rayd, current_tet)) != current_tet) { current_tet = nexttet; lslot = -1; d.depth--; continue; } // origin on the boundary of start
+			if (ray_step_hit(current_tet, nextface, nexttet, flags & 1, (flags >> 4) & 1, d)) hitfound = true;
+		}
+		else
+		{
+			GetExitTet(mesh, current_tet, rayo, rayd, rayw, lastface, nextface, nexttet);
+			if (nextface == -1 && d.depth == 0 && (nexttet = FindRayStartTet(mesh, rayo, rayd, current_tet)) != current_tet) { current_tet = nexttet; d.depth--; continue; } // origin on the boundary of start
+			if (ray_step_hit(mesh, current_tet, nextface, nexttet, d)) hitfound = true;
 			lastface = nextface;
-			current_tet = nexttet;
 		}
+		current_tet = nexttet;
 	}
 
 	// get nodes from nextface
@@ -520,35 +2772,63 @@ void traverse_ray(mesh2 *mesh, float4 rayo, float4 rayd, int32_t start, rayhit &
 	}
 }
 
-/* traverse the mesh until the tetrahedron which contains the specific point 'end' is found */
-void traverse_until_point(mesh2 *mesh, float4 rayo, float4 rayd, int32_t start, float4 end, rayhit &d)
+/* traverse_ray in the precision of the ray (see GetExitTet with tet_vec3 rays): float, double, or a double */
+/* origin with a float direction (mixed). For meshes far from the origin, call init_double_nodes() first. */
+/* Rays starting outside of the mesh (start -1) are marked lost */
+template <typename T, typename S>
+void traverse_ray(mesh2 *mesh, const tet_vec3<S> &rayo, const tet_vec3<T> &rayd, int32_t start, rayhit &d, int max_steps = TET_MAX_STEPS)
 {
+	if (start < 0 || start >= (int32_t)mesh->tetnum) { d.depth = 0; d.lost = true; d.tet = -1; d.face = -1; return; } // origin outside of the mesh
 	int32_t current_tet = start;
-	int32_t nexttet, nextface, lastface = 0;
+	int32_t nexttet = -1, nextface = -1, lastface = -1;
 	bool hitfound = false;
 
-	for (d.depth = 0; d.depth < 80; d.depth++)
+	for (d.depth = 0; !hitfound && d.depth < max_steps; d.depth++)
 	{
-		if (!hitfound)
+		GetExitTet(mesh, current_tet, rayo, rayd, lastface, nextface, nexttet);
+		if (nextface == -1 && d.depth == 0)
 		{
-			int32_t findex[4] = { mesh->t_findex1[current_tet], mesh->t_findex2[current_tet], mesh->t_findex3[current_tet], mesh->t_findex4[current_tet] };
-			int32_t adjtets[4] = { mesh->t_adjtet1[current_tet], mesh->t_adjtet2[current_tet], mesh->t_adjtet3[current_tet], mesh->t_adjtet4[current_tet] };
-			float4 nodes[4] = {
-				make_float4(mesh->n_x[mesh->t_nindex1[current_tet]], mesh->n_y[mesh->t_nindex1[current_tet]], mesh->n_z[mesh->t_nindex1[current_tet]], 0),
-				make_float4(mesh->n_x[mesh->t_nindex2[current_tet]], mesh->n_y[mesh->t_nindex2[current_tet]], mesh->n_z[mesh->t_nindex2[current_tet]], 0),
-				make_float4(mesh->n_x[mesh->t_nindex3[current_tet]], mesh->n_y[mesh->t_nindex3[current_tet]], mesh->n_z[mesh->t_nindex3[current_tet]], 0),
-				make_float4(mesh->n_x[mesh->t_nindex4[current_tet]], mesh->n_y[mesh->t_nindex4[current_tet]], mesh->n_z[mesh->t_nindex4[current_tet]], 0) };
+			// origin on the boundary of start, see FindRayStartTet()
+			int32_t t = FindRayStartTet(mesh, (double)rayo.x, (double)rayo.y, (double)rayo.z, current_tet, [&](int32_t tet)
+			{
+				int32_t face, next;
+				GetExitTet(mesh, tet, rayo, rayd, -1, face, next);
+				return face != -1;
+			});
+			if (t != current_tet) { current_tet = t; d.depth--; continue; }
+		}
+		if (ray_step_hit(mesh, current_tet, nextface, nexttet, d)) hitfound = true;
+		lastface = nextface;
+		current_tet = nexttet;
+	}
+
+	if (!hitfound)
+	{
+		d.dark = true;
+		d.face = nextface;
+		d.tet = current_tet;
+	}
+}
+
+/* traverse the mesh until the tetrahedron which contains the specific point 'end' is found */
+void traverse_until_point(mesh2 *mesh, float4 rayo, float4 rayd, int32_t start, float4 end, rayhit &d, int max_steps = TET_MAX_STEPS)
+{
+	if (start < 0 || start >= (int32_t)mesh->tetnum) { d.depth = 0; d.lost = true; d.tet = -1; d.face = -1; return; } // origin outside of the mesh
+	int32_t current_tet = start;
+	int32_t nexttet = -1, nextface = -1, lastface = -1;
+	float4 rayw = Cross(rayo, rayd);
+	bool hitfound = false;
 
-			GetExitTet(rayo, rayd, nodes, findex, adjtets, lastface, nextface, nexttet);
+	for (d.depth = 0; !hitfound && d.depth < max_steps; d.depth++)
+	{
+		GetExitTet(mesh, current_tet, rayo, rayd, rayw, lastface, nextface, nexttet);
+		if (nextface == -1 && d.depth == 0 && (nexttet = FindRayStartTet(mesh, rayo, rayd, current_tet)) != current_tet) { current_tet = nexttet; d.depth--; continue; } // origin on the boundary of start
 
-			if (IsPointInTetrahedron(nodes[0], nodes[1], nodes[2], nodes[3], end)) { hitfound = true;d.face = nextface; d.tet = current_tet;  }
+		if (IsPointInThisTet(mesh, end, current_tet)) { hitfound = true;d.face = nextface; d.tet = current_tet;  }
 
-			if (mesh->face_is_constrained[nextface] == true) { d.constrained = true; d.face = nextface; d.tet = current_tet; hitfound = true; } // vorher tet = nexttet
-			if (mesh->face_is_wall[nextface] == true) { d.wall = true; d.face = nextface; d.tet = current_tet; hitfound = true; } // vorher tet = nexttet
-			if (nexttet == -1 || nextface == -1) { d.wall = true; d.face = nextface; d.tet = current_tet; hitfound = true; } // when adjacent tetrahedra is -1, ray stops
-			lastface = nextface;
-			current_tet = nexttet;
-		}
+		if (ray_step_hit(mesh, current_tet, nextface, nexttet, d)) hitfound = true;
+		lastface = nextface;
+		current_tet = nexttet;
 	}
 
 	if (!hitfound)
@@ -561,6 +2841,382 @@ void traverse_until_point(mesh2 *mesh, float4 rayo, float4 rayd, int32_t start,
 
 
 
+/* GetExitTet for N rays (e.g. 4, 8 or 16) at once, lanes with tet[i] < 0 are skipped */
+/* the node gathers and edge products of all lanes are computed in SoA arrays the compiler can vectorize, */
+/* the error filter and exit face selection stay per lane. Results equal GetExitTet */
+template <int N>
+void GetExitTetPacket(mesh2 *mesh, const int32_t tet[N], const float4 rayo[N], const float4 rayd[N], const int32_t lface[N], int32_t face[N], int32_t nexttet[N])
+{
+	// gather the nodes of every lane's tetrahedron relative to its origin, skipped lanes use tet 0
+	float px[4][N], py[4][N], pz[4][N], qx[N], qy[N], qz[N];
+	for (int i = 0; i < N; i++)
+	{
+		int32_t t = (tet[i] >= 0) ? tet[i] : 0;
+		float4 nodes[4];
+		GetTraversalNodes(mesh, t, (mesh->t_packed != nullptr) ? mesh->t_packed[t].node : nullptr, nodes);
+		for (int k = 0; k < 4; k++)
+		{
+			px[k][i] = nodes[k].x - rayo[i].x;
+			py[k][i] = nodes[k].y - rayo[i].y;
+			pz[k][i] = nodes[k].z - rayo[i].z;
+		}
+		qx[i] = rayd[i].x; qy[i] = rayd[i].y; qz[i] = rayd[i].z;
+	}
+
+	// the six edge products of GetExitTet and their error bound, lane by lane
+	float Q[6][N], bound[N];
+	for (int i = 0; i < N; i++)
+	{
+		float ax = qy[i] * pz[0][i] - qz[i] * py[0][i], ay = qz[i] * px[0][i] - qx[i] * pz[0][i], az = qx[i] * py[0][i] - qy[i] * px[0][i];
+		float bx = qy[i] * pz[1][i] - qz[i] * py[1][i], by = qz[i] * px[1][i] - qx[i] * pz[1][i], bz = qx[i] * py[1][i] - qy[i] * px[1][i];
+		float cx = qy[i] * pz[2][i] - qz[i] * py[2][i], cy = qz[i] * px[2][i] - qx[i] * pz[2][i], cz = qx[i] * py[2][i] - qy[i] * px[2][i];
+		Q[0][i] = px[1][i] * ax + py[1][i] * ay + pz[1][i] * az; // A B
+		Q[1][i] = px[2][i] * bx + py[2][i] * by + pz[2][i] * bz; // B C
+		Q[2][i] = px[2][i] * ax + py[2][i] * ay + pz[2][i] * az; // A C
+		Q[3][i] = px[3][i] * ax + py[3][i] * ay + pz[3][i] * az; // A D
+		Q[4][i] = px[3][i] * bx + py[3][i] * by + pz[3][i] * bz; // B D
+		Q[5][i] = px[3][i] * cx + py[3][i] * cy + pz[3][i] * cz; // C D
+		float pmax = 0;
+		for (int k = 0; k < 4; k++) pmax = std::max(pmax, std::max(std::max(fabsf(px[k][i]), fabsf(py[k][i])), fabsf(pz[k][i])));
+		float qmax = std::max(std::max(fabsf(qx[i]), fabsf(qy[i])), fabsf(qz[i]));
+		bound[i] = TET_FILTER_EPS * 6.0f * qmax * pmax * pmax;
+	}
+
+	// sign masks of all lanes, the exit faces are looked up without branching on the ray directions
+	uint32_t pos[N], neg[N];
+	for (int i = 0; i < N; i++)
+	{
+		pos[i] = neg[i] = 0;
+		for (int k = 0; k < 6; k++)
+		{
+			pos[i] |= (uint32_t)(Q[k][i] > 0) << k;
+			neg[i] |= (uint32_t)(Q[k][i] < 0) << k;
+		}
+	}
+
+	for (int i = 0; i < N; i++)
+	{
+		int32_t t = tet[i];
+		if (t < 0) continue;
+		float q[6] = { Q[0][i], Q[1][i], Q[2][i], Q[3][i], Q[4][i], Q[5][i] };
+		float b = bound[i];
+		bool resolved = false;
+		if (fabsf(q[0]) <= b || fabsf(q[1]) <= b || fabsf(q[2]) <= b || fabsf(q[3]) <= b || fabsf(q[4]) <= b || fabsf(q[5]) <= b)
+		{
+			float4 nodes[4];
+			GetTraversalNodes(mesh, t, nullptr, nodes);
+			float bounds[6] = { b, b, b, b, b, b };
+			ResolveUncertainProducts(q, bounds, rayo[i], rayd[i], nodes);
+			resolved = true;
+		}
+		int32_t findex[4], adjtets[4];
+		if (mesh->t_packed != nullptr)
+		{
+			const tet_record &r = mesh->t_packed[t];
+			for (int k = 0; k < 4; k++) { findex[k] = r.face[k]; adjtets[k] = (r.adj[k] < 0) ? -1 : r.adj[k] >> 2; }
+		}
+		else
+		{
+			findex[0] = mesh->t_findex1[t]; findex[1] = mesh->t_findex2[t]; findex[2] = mesh->t_findex3[t]; findex[3] = mesh->t_findex4[t];
+			adjtets[0] = mesh->t_adjtet1[t]; adjtets[1] = mesh->t_adjtet2[t]; adjtets[2] = mesh->t_adjtet3[t]; adjtets[3] = mesh->t_adjtet4[t];
+		}
+		if (resolved || (pos[i] | neg[i]) != 0x3f)
+		{
+			// exact signs may be 0 and NaN fails every test, so these lanes take the sign tests one by one
+			GetExitFromProducts(q, findex, adjtets, lface[i], face[i], nexttet[i]);
+			continue;
+		}
+		uint32_t keep = (uint32_t)(findex[0] != lface[i]) | (uint32_t)(findex[1] != lface[i]) << 1 | (uint32_t)(findex[2] != lface[i]) << 2 | (uint32_t)(findex[3] != lface[i]) << 3;
+		int slot = ExitSlotOfMask(pos[i], keep);
+		face[i] = (slot < 0) ? -1 : findex[slot];
+		nexttet[i] = (slot < 0) ? -1 : adjtets[slot];
+	}
+}
+
+/* traverses a packet of N rays like traverse_ray, one tetrahedron per ray and step with GetExitTetPacket */
+/* lanes that stop early are masked and lanes that walk into other tetrahedra follow their own, so */
+/* coherent packets (same start, similar directions) profit most. Lanes starting outside of the mesh */
+/* (start -1) are marked lost. Results equal traverse_ray */
+template <int N>
+void traverse_packet(mesh2 *mesh, const float4 *rayo, const float4 *rayd, const int32_t *start, rayhit *d, int max_steps = TET_MAX_STEPS)
+{
+	int32_t current_tet[N], lastface[N], nextface[N], nexttet[N], lanetet[N];
+	bool active[N];
+	for (int i = 0; i < N; i++)
+	{
+		current_tet[i] = start[i];
+		lastface[i] = nextface[i] = nexttet[i] = -1;
+		active[i] = max_steps > 0;
+		d[i].depth = 0;
+		if (start[i] < 0 || start[i] >= (int32_t)mesh->tetnum) { active[i] = false; d[i].lost = true; d[i].tet = -1; d[i].face = -1; } // origin outside of the mesh
+		else if (!active[i]) { d[i].dark = true; d[i].face = -1; d[i].tet = start[i]; } // dark at the start like traverse_ray
+	}
+
+	// every lane counts its own steps, a start tetrahedron swapped by FindRayStartTet() takes none
+	for (;;)
+	{
+		int count = 0;
+		for (int i = 0; i < N; i++) { count += active[i]; lanetet[i] = active[i] ? current_tet[i] : -1; }
+		if (count == 0) break;
+
+		GetExitTetPacket<N>(mesh, lanetet, rayo, rayd, lastface, nextface, nexttet);
+
+		for (int i = 0; i < N; i++)
+		{
+			if (!active[i]) continue;
+			int32_t t;
+			if (nextface[i] == -1 && d[i].depth == 0 && (t = FindRayStartTet(mesh, rayo[i], rayd[i], current_tet[i])) != current_tet[i]) { current_tet[i] = t; continue; } // origin on the boundary of start
+			d[i].depth++;
+			if (ray_step_hit(mesh, current_tet[i], nextface[i], nexttet[i], d[i])) active[i] = false;
+			else if (d[i].depth >= max_steps) { active[i] = false; d[i].dark = true; d[i].face = nextface[i]; d[i].tet = nexttet[i]; }
+			lastface[i] = nextface[i];
+			current_tet[i] = nexttet[i];
+		}
+	}
+}
+
+/* rays of a stream are regrouped by blocks of 2^TET_STREAM_BLOCK_SHIFT consecutive tetrahedra, */
+/* every TET_STREAM_REGROUP waves */
+#ifndef TET_STREAM_BLOCK_SHIFT
+#define TET_STREAM_BLOCK_SHIFT 6
+#endif
+#ifndef TET_STREAM_REGROUP
+#define TET_STREAM_REGROUP 8
+#endif
+/* a wave of traverse_stream is spread over the threads from this many active rays on, */
+/* in chunks of TET_STREAM_CHUNK rays (a multiple of the packet size 8) */
+#ifndef TET_STREAM_PARALLEL
+#define TET_STREAM_PARALLEL 4096
+#endif
+#ifndef TET_STREAM_CHUNK
+#define TET_STREAM_CHUNK 256
+#endif
+
+// state of an active ray in traverse_stream
+struct stream_ray
+{
+	float4 o, q;
+	int32_t tet, lface;
+	uint32_t id;
+	int32_t depth;
+};
+
+/* traverses n rays like traverse_ray, meant for large batches (1M rays and more): all active rays are */
+/* advanced one tetrahedron per wave in packets of 8 (GetExitTetPacket), finished rays are written out */
+/* and dropped, and the remaining rays are regrouped by the block of their current tetrahedron (radix */
+/* sort of the ray records), so rays in neighbouring tetrahedra share lanes and cache lines. The waves */
+/* run on a team of up to 'threads' threads (0 = all cores) that lives for the whole call; waves with */
+/* fewer than TET_STREAM_PARALLEL rays stay on the calling thread. Memory: 2 x 48 bytes per ray. Rays starting */
+/* outside of the mesh (start -1) are marked lost. Results otherwise equal traverse_ray */
+void traverse_stream(mesh2 *mesh, const float4 *rayo, const float4 *rayd, const int32_t *start, size_t n, rayhit *d, int max_steps = TET_MAX_STEPS, unsigned threads = 0)
+{
+	const int P = 8;
+	std::vector<stream_ray> active, sorted;
+	active.reserve(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		d[i].depth = 0;
+		if (start[i] >= 0 && start[i] < (int32_t)mesh->tetnum) active.push_back({ rayo[i], rayd[i], start[i], -1, (uint32_t)i, 0 });
+		else { d[i].lost = true; d[i].tet = -1; d[i].face = -1; } // origin outside of the mesh
+	}
+	if (max_steps <= 0)
+	{
+		// dark at the start like traverse_ray
+		for (const stream_ray &r : active) { d[r.id].dark = true; d[r.id].face = -1; d[r.id].tet = r.tet; }
+		active.clear();
+	}
+
+	int bits = 1;
+	while (bits < 32 && ((mesh->tetnum >> TET_STREAM_BLOCK_SHIFT) >> bits) != 0) bits++;
+	std::vector<char> done;
+	tet_thread_team team((n >= TET_STREAM_PARALLEL) ? threads : 1);
+
+	// every ray counts its own steps, a start tetrahedron swapped by FindRayStartTet() takes none
+	for (int step = 0; !active.empty(); step++)
+	{
+		size_t count = active.size();
+		if (step % TET_STREAM_REGROUP == 0)
+		{
+			// LSD radix sort of the ray records by tetrahedron block, 11 bits per pass
+			sorted.resize(count);
+			for (int shift = 0; shift < bits; shift += 11)
+			{
+				size_t offset[2049] = { 0 };
+				for (size_t i = 0; i < count; i++) offset[((active[i].tet >> TET_STREAM_BLOCK_SHIFT) >> shift & 2047) + 1]++;
+				for (int b = 0; b < 2048; b++) offset[b + 1] += offset[b];
+				for (size_t i = 0; i < count; i++) sorted[offset[(active[i].tet >> TET_STREAM_BLOCK_SHIFT) >> shift & 2047]++] = active[i];
+				active.swap(sorted);
+			}
+		}
+
+		// one step of every active ray
+		done.assign(count, 0);
+		team.run(count, TET_STREAM_CHUNK, count >= TET_STREAM_PARALLEL, [&](size_t begin, size_t end)
+		{
+			for (size_t p = begin / P; p < (end + P - 1) / P; p++)
+			{
+				int32_t lanetet[P], lastface[P], face[P], next[P];
+				float4 o[P], q[P];
+				for (int i = 0; i < P; i++)
+				{
+					const stream_ray &r = active[std::min(p * P + i, count - 1)];
+					lanetet[i] = (p * P + i < count) ? r.tet : -1;
+					lastface[i] = r.lface;
+					o[i] = r.o;
+					q[i] = r.q;
+				}
+				GetExitTetPacket<P>(mesh, lanetet, o, q, lastface, face, next);
+				for (int i = 0; i < P && p * P + i < count; i++)
+				{
+					stream_ray &r = active[p * P + i];
+					int32_t t;
+					if (face[i] == -1 && r.depth == 0 && (t = FindRayStartTet(mesh, r.o, r.q, r.tet)) != r.tet) { r.tet = t; continue; } // origin on the boundary of start
+					r.depth++;
+					rayhit &h = d[r.id];
+					if (ray_step_hit(mesh, r.tet, face[i], next[i], h)) { h.depth = r.depth; done[p * P + i] = 1; }
+					else if (r.depth >= max_steps) { h.depth = r.depth; h.dark = true; h.face = face[i]; h.tet = next[i]; done[p * P + i] = 1; }
+					r.lface = face[i];
+					r.tet = next[i];
+				}
+			}
+		});
+
+		size_t kept = 0;
+		for (size_t i = 0; i < count; i++) if (!done[i]) active[kept++] = active[i];
+		active.resize(kept);
+	}
+}
+
+// prefetches the records of tet, first stage of traverse_interleaved
+void prefetch_tet(mesh2 *mesh, int32_t tet)
+{
+	if (mesh->e_plucker == nullptr && mesh->t_verts != nullptr) { TET_PREFETCH(mesh->t_verts + 12 * (size_t)tet); TET_PREFETCH(mesh->t_verts + 12 * (size_t)tet + 11); }
+	if (mesh->e_plucker == nullptr && mesh->t_cverts != nullptr) TET_PREFETCH(mesh->t_cverts + tet);
+	if (mesh->t_packed != nullptr)
+	{
+		TET_PREFETCH(mesh->t_packed + tet);
+		if (mesh->t_edges != nullptr) TET_PREFETCH(mesh->t_edges + 6 * (size_t)tet);
+		return;
+	}
+	TET_PREFETCH(mesh->t_nindex1 + tet); TET_PREFETCH(mesh->t_nindex2 + tet); TET_PREFETCH(mesh->t_nindex3 + tet); TET_PREFETCH(mesh->t_nindex4 + tet);
+	TET_PREFETCH(mesh->t_adjtet1 + tet); TET_PREFETCH(mesh->t_adjtet2 + tet); TET_PREFETCH(mesh->t_adjtet3 + tet); TET_PREFETCH(mesh->t_adjtet4 + tet);
+	TET_PREFETCH(mesh->t_findex1 + tet); TET_PREFETCH(mesh->t_findex2 + tet); TET_PREFETCH(mesh->t_findex3 + tet); TET_PREFETCH(mesh->t_findex4 + tet);
+	if (mesh->t_edges != nullptr) TET_PREFETCH(mesh->t_edges + 6 * (size_t)tet);
+}
+
+// prefetches the nodes (or edges) and face flags of tet, whose records must be cached already
+void prefetch_tet_data(mesh2 *mesh, int32_t tet)
+{
+	if (mesh->e_plucker != nullptr)
+	{
+		for (int e = 0; e < 6; e++) TET_PREFETCH(mesh->e_plucker + 8 * (size_t)(mesh->t_edges[6 * (size_t)tet + e] >> 1));
+	}
+	else if (mesh->t_verts == nullptr && mesh->t_cverts == nullptr) // cached vertices come with prefetch_tet
+	{
+		const int32_t *n = (mesh->t_packed != nullptr) ? mesh->t_packed[tet].node : nullptr;
+		int32_t soa[4];
+		if (n == nullptr) { soa[0] = mesh->t_nindex1[tet]; soa[1] = mesh->t_nindex2[tet]; soa[2] = mesh->t_nindex3[tet]; soa[3] = mesh->t_nindex4[tet]; n = soa; }
+		for (int k = 0; k < 4; k++) { TET_PREFETCH(mesh->n_x + n[k]); TET_PREFETCH(mesh->n_y + n[k]); TET_PREFETCH(mesh->n_z + n[k]); }
+	}
+	if (mesh->t_packed != nullptr) return; // face flags are in the record
+	int32_t f[4] = { mesh->t_findex1[tet], mesh->t_findex2[tet], mesh->t_findex3[tet], mesh->t_findex4[tet] };
+	for (int k = 0; k < 4; k++) { TET_PREFETCH(mesh->face_is_constrained + f[k]); TET_PREFETCH(mesh->face_is_wall + f[k]); }
+}
+
+/* upper limit of rays interleaved by traverse_interleaved */
+#define TET_MAX_INTERLEAVE 64
+
+/* traverses n rays like traverse_ray, 'slots' rays at a time on the calling thread: the rays take turns */
+/* doing one step each, and after its step a ray prefetches the records of its next tetrahedron; half a */
+/* round later, when those have arrived, its nodes and face flags are prefetched. The memory latency of */
+/* one ray is so hidden behind the steps of the others, which pays off on meshes much larger than the */
+/* caches. Finished rays are replaced by the next ray of the batch. Rays starting outside of the mesh */
+/* (start -1) are marked lost, results otherwise equal traverse_ray */
+void traverse_interleaved(mesh2 *mesh, const float4 *rayo, const float4 *rayd, const int32_t *start, size_t n, rayhit *d, int max_steps = TET_MAX_STEPS, int slots = 16)
+{
+	slots = std::min(std::max(slots, 1), TET_MAX_INTERLEAVE);
+	int64_t ray[TET_MAX_INTERLEAVE];
+	int32_t tet[TET_MAX_INTERLEAVE], lface[TET_MAX_INTERLEAVE];
+	float4 rayw[TET_MAX_INTERLEAVE];
+	size_t nextray = 0;
+	int live = 0;
+
+	// puts the next ray of the batch into slot s, -1 if none is left
+	auto refill = [&](int s)
+	{
+		ray[s] = -1;
+		while (nextray < n)
+		{
+			size_t r = nextray++;
+			d[r].depth = 0;
+			if (start[r] < 0 || start[r] >= (int32_t)mesh->tetnum) { d[r].lost = true; d[r].face = -1; d[r].tet = -1; continue; } // origin outside of the mesh
+			if (max_steps <= 0) { d[r].dark = true; d[r].face = -1; d[r].tet = start[r]; continue; }
+			ray[s] = (int64_t)r;
+			tet[s] = start[r];
+			lface[s] = -1;
+			rayw[s] = Cross(rayo[r], rayd[r]);
+			prefetch_tet(mesh, tet[s]);
+			live++;
+			return;
+		}
+	};
+	for (int s = 0; s < slots; s++) refill(s);
+
+	while (live > 0)
+	{
+		for (int s = 0; s < slots; s++)
+		{
+			int a = (s + slots / 2) % slots;
+			if (ray[a] >= 0) prefetch_tet_data(mesh, tet[a]);
+			if (ray[s] < 0) continue;
+
+			size_t r = (size_t)ray[s];
+			int32_t nextface, nexttet;
+			GetExitTet(mesh, tet[s], rayo[r], rayd[r], rayw[s], lface[s], nextface, nexttet);
+			if (nextface == -1 && d[r].depth == 0 && (nexttet = FindRayStartTet(mesh, rayo[r], rayd[r], tet[s])) != tet[s]) { tet[s] = nexttet; continue; } // origin on the boundary of start
+			d[r].depth++;
+			bool hitfound = ray_step_hit(mesh, tet[s], nextface, nexttet, d[r]);
+			lface[s] = nextface;
+			tet[s] = nexttet;
+			if (!hitfound && d[r].depth < max_steps) { prefetch_tet(mesh, nexttet); continue; }
+
+			if (!hitfound) { d[r].dark = true; d[r].face = nextface; d[r].tet = nexttet; }
+			live--;
+			refill(s);
+		}
+	}
+}
+
+/* options of traverse_rays */
+struct traverse_options
+{
+	unsigned threads = 0; // 0 = all cores
+	int max_steps = TET_MAX_STEPS;
+	size_t chunk = 256; // rays per scheduled chunk
+	int interleave = 0; // rays interleaved per thread with traverse_interleaved, 0 = one ray after the other
+};
+
+/* traverses n rays with traverse_ray on several threads, hits[i] belongs to ray i whatever the schedule */
+/* the rays are cut into chunks that are distributed with work stealing (tet_parallel_chunks), which */
+/* keeps the threads busy when ray lengths differ a lot. Rays starting outside of the mesh are marked lost */
+void traverse_rays(mesh2 *mesh, const float4 *origins, const float4 *dirs, const int32_t *start_tets, size_t n, rayhit *hits, const traverse_options &options = traverse_options())
+{
+	tet_parallel_chunks(n, options.chunk, options.threads, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; i++) hits[i] = rayhit();
+		if (options.interleave > 0)
+		{
+			traverse_interleaved(mesh, origins + begin, dirs + begin, start_tets + begin, end - begin, hits + begin, options.max_steps, options.interleave);
+			return;
+		}
+		for (size_t i = begin; i < end; i++)
+		{
+			if (start_tets[i] < 0 || start_tets[i] >= (int32_t)mesh->tetnum) { hits[i].lost = true; hits[i].tet = -1; hits[i].face = -1; continue; }
+			traverse_ray(mesh, origins[i], dirs[i], start_tets[i], hits[i], options.max_steps);
+		}
+	});
+}
+
 //----------------------- obj parser -----------------------------------------------------------------
 
 int loadObj(std::string inputfile)